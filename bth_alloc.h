@@ -20,6 +20,8 @@
 #ifndef BTH_ALLOC_H 
 #define BTH_ALLOC_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 #ifndef BTH_ALLOC_ERR
@@ -27,10 +29,67 @@
 #define BTH_ALLOC_ERR(c, msg, ...) err(c, msg, __VA_ARGS__)
 #endif
 
+// allocator carried by container instances (bth_htab, bth_dynarray, ...)
+// containers use their compile time macros when it is NULL
+struct bth_allocator
+{
+    void *(*alloc)(void *ctx, size_t size);
+    // old is the size ptr was allocated with
+    void *(*realloc)(void *ctx, void *ptr, size_t old, size_t size);
+    void (*free)(void *ctx, void *ptr, size_t size);
+    void *ctx;
+};
+
 #ifdef BTH_BALLOC
 
 #define BALLOC_LOCKED (1 << 0)
 #define BALLOC_STATIC (1 << 1)
+// chain a new block when full instead of failing
+#define BALLOC_CHUNKED (1 << 2)
+// reserved virtual range committed as len grows (see bth_balloc_vinit)
+#define BALLOC_VMEM (1 << 3)
+// back a BALLOC_VMEM arena with transparent huge pages when available
+#define BALLOC_HUGEPAGE (1 << 4)
+
+// minimal size of a chained block
+#ifndef BTH_BALLOC_CHUNK
+#define BTH_BALLOC_CHUNK 4096
+#endif
+
+// commit granularity of BALLOC_VMEM arenas
+#ifndef BTH_BALLOC_COMMIT
+#define BTH_BALLOC_COMMIT 65536
+#endif
+
+#define BTH_BALLOC_HUGE (1 << 21)
+
+#ifndef BTH_ALLOC_CACHELINE
+#define BTH_ALLOC_CACHELINE 64
+#endif
+
+// alignment of arena backed allocator blocks, max_align_t is C11 only
+#ifndef BTH_ALLOC_MAXALIGN
+#if __STDC_VERSION__ >= 201112L
+#define BTH_ALLOC_MAXALIGN _Alignof(max_align_t)
+#else
+#define BTH_ALLOC_MAXALIGN \
+    _Alignof(union { long double d; long long l; void *p; })
+#endif
+#endif
+
+// n items of type T, aligned for T
+#define BTH_BALLOC_ARRAY(t, T, n) \
+    ((T *)bth_balloc_array(t, n, sizeof(T), _Alignof(T)))
+
+// state of a full block, stored in front of the block that replaced it
+struct bth_achunk
+{
+    struct bth_achunk *prev;
+    size_t cap;
+    size_t len;
+    void *data;
+    size_t commit;
+};
 
 struct bth_arena
 {
@@ -38,11 +97,128 @@ struct bth_arena
     size_t len;
     void *data;
     char flags;
+    struct bth_achunk *prev; // full blocks, newest first
+    size_t commit; // committed bytes of a BALLOC_VMEM block
+#ifdef BTH_ALLOC_STATS
+    size_t used; // bytes handed out, padding included
+    size_t hwm; // high-water mark of used
+#endif
+};
+
+// arena position to rewind to
+struct bth_amark
+{
+    struct bth_achunk *prev;
+    size_t len;
+#ifdef BTH_ALLOC_STATS
+    size_t used;
+#endif
 };
 
+struct bth_arena bth_balloc_init(size_t cap, char flags);
+// reserve (never commit) a virtual range of cap bytes, BALLOC_VMEM is implied
+// without anonymous mappings, returns a BALLOC_CHUNKED arena instead
+struct bth_arena bth_balloc_vinit(size_t cap, char flags);
 void bth_balloc_resize(struct bth_arena *t);
 void bth_balloc_free(struct bth_arena *t);
 void *bth_balloc(struct bth_arena *t, size_t s);
+// align MUST be a power of two
+void *bth_balloc_aligned(struct bth_arena *t, size_t s, size_t align);
+void *bth_balloc_array(struct bth_arena *t, size_t n, size_t isize,
+    size_t align);
+
+struct bth_amark bth_balloc_mark(struct bth_arena *t);
+// release everything allocated since m, m MUST come from t
+void bth_balloc_rewind(struct bth_arena *t, struct bth_amark m);
+// release everything but the initial block
+void bth_balloc_reset(struct bth_arena *t);
+// give back the committed pages above len of a BALLOC_VMEM arena
+void bth_balloc_decommit(struct bth_arena *t);
+
+void bth_balloc__chain(struct bth_arena *t, size_t size);
+void bth_balloc__pop(struct bth_arena *t);
+void bth_balloc__commit(struct bth_arena *t, size_t len);
+
+// pool of same-size objects carved from arena pages
+// pages are aligned on their (power of two) size and their first cache line
+// holds the owning pool
+
+#ifndef BTH_POOL_PAGE
+#define BTH_POOL_PAGE 16384
+#endif
+
+// pool owning obj, only valid for pools with BTH_POOL_PAGE pages
+#define BTH_POOL_OWNER(obj) \
+    (*(struct bth_pool **)((uintptr_t)(obj) & ~(uintptr_t)(BTH_POOL_PAGE - 1)))
+
+struct bth_pool
+{
+    size_t isize; // object size
+    size_t psize; // page size
+    void *free; // released objects, linked through their first word
+    char *cur; // next never used object of the newest page
+    char *end;
+    struct bth_arena *arena; // page source, own arena if NULL
+    struct bth_arena own;
+};
+
+// size classes are powers of two, from 8 to BTH_SLAB_MAX
+#ifndef BTH_SLAB_CLASSES
+#define BTH_SLAB_CLASSES 8
+#endif
+
+#define BTH_SLAB_MAX (8 << (BTH_SLAB_CLASSES - 1))
+
+struct bth_slab
+{
+    struct bth_pool pools[BTH_SLAB_CLASSES];
+};
+
+// pages are taken from arena, or from an arena owned by the pool if NULL
+void bth_pool_init(struct bth_pool *p, size_t isize, struct bth_arena *arena);
+void *bth_pool_alloc(struct bth_pool *p);
+void bth_pool_release(struct bth_pool *p, void *obj);
+// release the pages of the own arena, objects MUST not be used anymore
+void bth_pool_free(struct bth_pool *p);
+
+void bth_slab_init(struct bth_slab *s, struct bth_arena *arena);
+// sizes above BTH_SLAB_MAX go through smalloc
+void *bth_slab_alloc(struct bth_slab *s, size_t size);
+// size MUST be the one given to bth_slab_alloc
+void bth_slab_release(struct bth_slab *s, void *obj, size_t size);
+void bth_slab_free(struct bth_slab *s);
+
+// frees are no-ops, reallocs of the last allocation grow in place
+struct bth_allocator bth_allocator_arena(struct bth_arena *t);
+struct bth_allocator bth_allocator_slab(struct bth_slab *s);
+
+#ifndef __STDC_NO_ATOMICS__
+#include <stdatomic.h>
+
+// pool allocating without locks on its owner thread, objects released by
+// other threads are pushed on a lock-free stack and reused by the owner
+struct bth_tpool
+{
+    struct bth_pool pool;
+    const void *thread; // owner thread
+    _Atomic(void *) remote;
+};
+
+// this thread's chunked arena, bth_balloc_local_free before thread exit
+struct bth_arena *bth_balloc_local(void);
+void bth_balloc_local_free(void);
+
+// MUST be called on the owner thread
+// isize MUST be <= (BTH_POOL_PAGE - BTH_ALLOC_CACHELINE) / 8 once rounded up
+// to a pointer size multiple, so that pages keep the BTH_POOL_OWNER size
+void bth_tpool_init(struct bth_tpool *tp, size_t isize);
+// owner thread only
+void *bth_tpool_alloc(struct bth_tpool *tp);
+// any thread
+void bth_tpool_release(void *obj);
+// once no thread uses its objects anymore
+void bth_tpool_free(struct bth_tpool *tp);
+#endif
 
 #endif
 
@@ -50,13 +226,49 @@ void *smalloc(size_t size);
 void *srealloc(void *ptr, size_t size);
 void *scalloc(size_t nmemb, size_t size);
 
+// per call site counters of smalloc/srealloc/scalloc, not thread safe
+#ifdef BTH_ALLOC_STATS
+#include <stdio.h>
+
+#ifndef BTH_ALLOC_SITES
+#define BTH_ALLOC_SITES 256
+#endif
+
+struct bth_alloc_site
+{
+    const char *file;
+    int line;
+    size_t calls;
+    size_t bytes;
+    size_t moves; // reallocs that copied to a new block
+};
+
+void *bth_alloc__smalloc(size_t size, const char *file, int line);
+void *bth_alloc__srealloc(void *ptr, size_t size, const char *file,
+    int line);
+void *bth_alloc__scalloc(size_t nmemb, size_t size, const char *file,
+    int line);
+
+// sites sorted by bytes and log2 histogram of requested sizes
+void bth_alloc_stats_dump(FILE *f);
+void bth_alloc_stats_reset(void);
+
+#define smalloc(n) bth_alloc__smalloc(n, __FILE__, __LINE__)
+#define srealloc(p, n) bth_alloc__srealloc(p, n, __FILE__, __LINE__)
+#define scalloc(m, n) bth_alloc__scalloc(m, n, __FILE__, __LINE__)
 #endif
 
-#ifdef BTH_ALLOC_IMPLEMENTATION
+#endif
+
+#if defined(BTH_ALLOC_IMPLEMENTATION) && !defined(__BTH_ALLOC_IMPL)
+// other headers include this one
+#define __BTH_ALLOC_IMPL
 #include <err.h>
 #include <errno.h>
+#include <string.h>
 
-void *smalloc(size_t size)
+// names are parenthesized to escape the BTH_ALLOC_STATS wrappers
+void *(smalloc)(size_t size)
 {
     void *d = malloc(size);
 
@@ -66,7 +278,7 @@ void *smalloc(size_t size)
     return d;
 }
 
-void *srealloc(void *ptr, size_t size)
+void *(srealloc)(void *ptr, size_t size)
 {
     void *d = realloc(ptr, size);
 
@@ -76,7 +288,7 @@ void *srealloc(void *ptr, size_t size)
     return d;
 }
 
-void *scalloc(size_t nmemb, size_t size)
+void *(scalloc)(size_t nmemb, size_t size)
 {
     void *d = calloc(nmemb, size);
 
@@ -86,10 +298,233 @@ void *scalloc(size_t nmemb, size_t size)
     return d;
 }
 
+#ifdef BTH_ALLOC_STATS
+// last slot collects the sites that do not fit
+static struct bth_alloc_site bth_alloc__sites[BTH_ALLOC_SITES + 1];
+// hist[i] counts the sizes of bit width i
+static size_t bth_alloc__hist[sizeof(size_t) * 8 + 1];
+
+struct bth_alloc_site *bth_alloc__site(const char *file, int line)
+{
+    size_t h = ((uintptr_t)file ^ (size_t)line * 2654435761u)
+        % BTH_ALLOC_SITES;
+
+    for (size_t i = 0; i < BTH_ALLOC_SITES; i++)
+    {
+        struct bth_alloc_site *s = bth_alloc__sites
+            + (h + i) % BTH_ALLOC_SITES;
+
+        if (!s->file)
+        {
+            s->file = file;
+            s->line = line;
+        }
+
+        if (s->file == file && s->line == line)
+            return s;
+    }
+
+    return bth_alloc__sites + BTH_ALLOC_SITES;
+}
+
+void bth_alloc__record(size_t size, const char *file, int line, int moved)
+{
+    struct bth_alloc_site *s = bth_alloc__site(file, line);
+    size_t w = 0;
+
+    while (w < sizeof(size_t) * 8 && size >> w)
+        w++;
+
+    s->calls++;
+    s->bytes += size;
+    s->moves += moved;
+    bth_alloc__hist[w]++;
+}
+
+void *bth_alloc__smalloc(size_t size, const char *file, int line)
+{
+    bth_alloc__record(size, file, line, 0);
+    return (smalloc)(size);
+}
+
+void *bth_alloc__srealloc(void *ptr, size_t size, const char *file,
+    int line)
+{
+    void *d = (srealloc)(ptr, size);
+
+    bth_alloc__record(size, file, line, ptr && d != ptr);
+    return d;
+}
+
+void *bth_alloc__scalloc(size_t nmemb, size_t size, const char *file,
+    int line)
+{
+    bth_alloc__record(nmemb * size, file, line, 0);
+    return (scalloc)(nmemb, size);
+}
+
+int bth_alloc__sitecmp(const void *a, const void *b)
+{
+    const struct bth_alloc_site *s1 = a;
+    const struct bth_alloc_site *s2 = b;
+
+    return (s1->bytes < s2->bytes) - (s1->bytes > s2->bytes);
+}
+
+void bth_alloc_stats_dump(FILE *f)
+{
+    struct bth_alloc_site sites[BTH_ALLOC_SITES + 1];
+
+    memcpy(sites, bth_alloc__sites, sizeof(sites));
+    qsort(sites, BTH_ALLOC_SITES + 1, sizeof(*sites), bth_alloc__sitecmp);
+
+    fprintf(f, "%-40s %12s %16s %12s\n", "site", "calls", "bytes", "moves");
+
+    for (size_t i = 0; i <= BTH_ALLOC_SITES && sites[i].calls; i++)
+    {
+        struct bth_alloc_site *s = sites + i;
+        fprintf(f, "%32s:%-7d %12zu %16zu %12zu\n",
+            s->file ? s->file : "(other)", s->line,
+            s->calls, s->bytes, s->moves);
+    }
+
+    fprintf(f, "\n%40s %12s\n", "size <=", "calls");
+
+    for (size_t w = 0; w <= sizeof(size_t) * 8; w++)
+    {
+        if (bth_alloc__hist[w])
+            fprintf(f, "%40zu %12zu\n",
+                w ? ((size_t)2 << (w - 1)) - 1 : 0, bth_alloc__hist[w]);
+    }
+}
+
+void bth_alloc_stats_reset(void)
+{
+    memset(bth_alloc__sites, 0, sizeof(bth_alloc__sites));
+    memset(bth_alloc__hist, 0, sizeof(bth_alloc__hist));
+}
+#endif
+
 #ifdef BTH_BALLOC
+#include <sys/mman.h>
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+// strict ISO modes (-std=c11) hide anonymous mappings, reserved arenas then
+// fall back to chunked ones growing from BTH_BALLOC_COMMIT bytes
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+struct bth_arena bth_balloc_init(size_t cap, char flags)
+{
+    struct bth_arena t = {
+        .cap = cap,
+        .len = 0,
+        .data = cap ? smalloc(cap) : NULL,
+        .flags = flags,
+        .prev = NULL,
+        .commit = 0,
+    };
+
+    return t;
+}
+
+struct bth_arena bth_balloc_vinit(size_t cap, char flags)
+{
+#ifndef MAP_ANONYMOUS
+    flags &= ~(BALLOC_VMEM | BALLOC_HUGEPAGE);
+    return bth_balloc_init(cap < BTH_BALLOC_COMMIT ? cap : BTH_BALLOC_COMMIT,
+        flags | BALLOC_CHUNKED);
+#else
+    size_t gran = flags & BALLOC_HUGEPAGE ? BTH_BALLOC_HUGE : BTH_BALLOC_COMMIT;
+    size_t len = (cap + gran - 1) & ~(gran - 1);
+
+    // over reserve to align the range on huge pages
+    size_t extra = flags & BALLOC_HUGEPAGE ? BTH_BALLOC_HUGE : 0;
+
+    char *d = mmap(NULL, len + extra, PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (d == MAP_FAILED)
+        BTH_ALLOC_ERR(1, "Cannot reserve %zu bytes", len);
+
+    if (extra)
+    {
+        size_t head = -(uintptr_t)d & (BTH_BALLOC_HUGE - 1);
+
+        if (head)
+            munmap(d, head);
+        if (extra - head)
+            munmap(d + head + len, extra - head);
+
+        d += head;
+#ifdef MADV_HUGEPAGE
+        madvise(d, len, MADV_HUGEPAGE);
+#endif
+    }
+
+    struct bth_arena t = {
+        .cap = len,
+        .len = 0,
+        .data = d,
+        .flags = flags | BALLOC_VMEM,
+        .prev = NULL,
+        .commit = 0,
+    };
+
+    return t;
+#endif
+}
+
+// commit pages of the reserved range up to len
+void bth_balloc__commit(struct bth_arena *t, size_t len)
+{
+    size_t gran = t->flags & BALLOC_HUGEPAGE
+        ? BTH_BALLOC_HUGE : BTH_BALLOC_COMMIT;
+    size_t commit = (len + gran - 1) & ~(gran - 1);
+
+    if (commit > t->cap)
+        commit = t->cap;
+
+    char *d = (char *)t->data + t->commit;
+
+    if (mprotect(d, commit - t->commit, PROT_READ | PROT_WRITE))
+        BTH_ALLOC_ERR(1, "Cannot commit %zu bytes", commit - t->commit);
+
+    t->commit = commit;
+}
+
+void bth_balloc_decommit(struct bth_arena *t)
+{
+    if (!(t->flags & BALLOC_VMEM) || t->prev)
+        return;
+
+    size_t gran = t->flags & BALLOC_HUGEPAGE
+        ? BTH_BALLOC_HUGE : BTH_BALLOC_COMMIT;
+    size_t keep = (t->len + gran - 1) & ~(gran - 1);
+
+    if (keep >= t->commit)
+        return;
+
+    char *d = (char *)t->data + keep;
+
+#ifdef MADV_DONTNEED
+    madvise(d, t->commit - keep, MADV_DONTNEED);
+#endif
+    mprotect(d, t->commit - keep, PROT_NONE);
+    t->commit = keep;
+}
+
 // resize arena capacity to len
+// chunked and reserved arenas are left untouched as their blocks never move
 void bth_balloc_resize(struct bth_arena *t)
 {
+    if (t->flags & (BALLOC_CHUNKED | BALLOC_VMEM))
+        return;
+
     void *d = srealloc(t->data, t->len);
     t->data = d;
     t->cap = t->len;
@@ -97,28 +532,414 @@ void bth_balloc_resize(struct bth_arena *t)
 
 void bth_balloc_free(struct bth_arena *t)
 {
+    while (t->prev)
+        bth_balloc__pop(t);
+
+    if (t->flags & BALLOC_VMEM)
+        munmap(t->data, t->cap);
+    else if (!(t->flags & BALLOC_STATIC))
+        free(t->data);
+
     t->cap = 0;
     t->len = 0;
-    free(t->data);
     t->data = NULL;
+    t->commit = 0;
+#ifdef BTH_ALLOC_STATS
+    t->used = 0;
+#endif
+}
+
+// retire the current block and start a new one of at least size bytes
+void bth_balloc__chain(struct bth_arena *t, size_t size)
+{
+    size_t cap = t->cap * 2;
+
+    if (cap < BTH_BALLOC_CHUNK)
+        cap = BTH_BALLOC_CHUNK;
+    if (cap < size)
+        cap = size;
+
+    struct bth_achunk *c = smalloc(sizeof(struct bth_achunk) + cap);
+
+    c->prev = t->prev;
+    c->cap = t->cap;
+    c->len = t->len;
+    c->data = t->data;
+    c->commit = t->commit;
+
+    t->prev = c;
+    t->cap = cap;
+    t->len = 0;
+    t->data = c + 1;
 }
 
+// free the current block and make the previous one current again
+void bth_balloc__pop(struct bth_arena *t)
+{
+    struct bth_achunk *c = t->prev;
+
+    t->prev = c->prev;
+    t->cap = c->cap;
+    t->len = c->len;
+    t->data = c->data;
+    t->commit = c->commit;
+
+    free(c);
+}
+
+struct bth_amark bth_balloc_mark(struct bth_arena *t)
+{
+    struct bth_amark m = {.prev = t->prev, .len = t->len};
+#ifdef BTH_ALLOC_STATS
+    m.used = t->used;
+#endif
+    return m;
+}
+
+void bth_balloc_rewind(struct bth_arena *t, struct bth_amark m)
+{
+    while (t->prev && t->prev != m.prev)
+        bth_balloc__pop(t);
+
+    if (m.len < t->len)
+        t->len = m.len;
+
+#ifdef BTH_ALLOC_STATS
+    t->used = m.used;
+#endif
+}
+
+void bth_balloc_reset(struct bth_arena *t)
+{
+    struct bth_amark m = {.prev = NULL, .len = 0};
+    bth_balloc_rewind(t, m);
+}
+
+void bth_pool_init(struct bth_pool *p, size_t isize, struct bth_arena *arena)
+{
+    // room for the free list link, keep objects pointer aligned
+    if (isize < sizeof(void *))
+        isize = sizeof(void *);
+    isize = (isize + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+    p->isize = isize;
+    p->psize = BTH_POOL_PAGE;
+
+    while (p->psize < BTH_ALLOC_CACHELINE + isize * 8)
+        p->psize *= 2;
+
+    p->free = NULL;
+    p->cur = NULL;
+    p->end = NULL;
+    p->arena = arena;
+    p->own = bth_balloc_init(0, BALLOC_CHUNKED);
+}
+
+void *bth_pool_alloc(struct bth_pool *p)
+{
+    void *obj = p->free;
+
+    if (obj)
+    {
+        p->free = *(void **)obj;
+        return obj;
+    }
+
+    if (p->end - p->cur < (ptrdiff_t)p->isize)
+    {
+        struct bth_arena *src = p->arena ? p->arena : &p->own;
+        char *page = bth_balloc_aligned(src, p->psize, p->psize);
+
+        *(struct bth_pool **)page = p;
+        p->cur = page + BTH_ALLOC_CACHELINE;
+        p->end = page + p->psize;
+    }
+
+    obj = p->cur;
+    p->cur += p->isize;
+
+    return obj;
+}
+
+void bth_pool_release(struct bth_pool *p, void *obj)
+{
+    *(void **)obj = p->free;
+    p->free = obj;
+}
+
+void bth_pool_free(struct bth_pool *p)
+{
+    bth_balloc_free(&p->own);
+    p->free = NULL;
+    p->cur = NULL;
+    p->end = NULL;
+}
+
+// smallest class holding size
+size_t bth_slab__class(size_t size)
+{
+    size_t c = 0;
+
+    while ((size_t)8 << c < size)
+        c++;
+
+    return c;
+}
+
+void bth_slab_init(struct bth_slab *s, struct bth_arena *arena)
+{
+    for (size_t c = 0; c < BTH_SLAB_CLASSES; c++)
+        bth_pool_init(s->pools + c, (size_t)8 << c, arena);
+}
+
+void *bth_slab_alloc(struct bth_slab *s, size_t size)
+{
+    if (size > BTH_SLAB_MAX)
+        return smalloc(size);
+
+    return bth_pool_alloc(s->pools + bth_slab__class(size));
+}
+
+void bth_slab_release(struct bth_slab *s, void *obj, size_t size)
+{
+    if (size > BTH_SLAB_MAX)
+        free(obj);
+    else
+        bth_pool_release(s->pools + bth_slab__class(size), obj);
+}
+
+void bth_slab_free(struct bth_slab *s)
+{
+    for (size_t c = 0; c < BTH_SLAB_CLASSES; c++)
+        bth_pool_free(s->pools + c);
+}
+
+void *bth_allocator__arena_alloc(void *ctx, size_t size)
+{
+    return bth_balloc_aligned(ctx, size, BTH_ALLOC_MAXALIGN);
+}
+
+void *bth_allocator__arena_realloc(void *ctx, void *ptr, size_t old,
+    size_t size)
+{
+    struct bth_arena *t = ctx;
+
+    if (size <= old)
+        return ptr;
+
+    if (ptr && (char *)ptr + old == (char *)t->data + t->len
+        && t->cap - t->len >= size - old)
+    {
+        bth_balloc(t, size - old);
+        return ptr;
+    }
+
+    void *d = bth_balloc_aligned(t, size, BTH_ALLOC_MAXALIGN);
+
+    if (ptr)
+        memcpy(d, ptr, old);
+
+    return d;
+}
+
+void bth_allocator__arena_free(void *ctx, void *ptr, size_t size)
+{
+    (void)ctx;
+    (void)ptr;
+    (void)size;
+}
+
+struct bth_allocator bth_allocator_arena(struct bth_arena *t)
+{
+    struct bth_allocator a = {
+        .alloc = bth_allocator__arena_alloc,
+        .realloc = bth_allocator__arena_realloc,
+        .free = bth_allocator__arena_free,
+        .ctx = t,
+    };
+
+    return a;
+}
+
+void *bth_allocator__slab_alloc(void *ctx, size_t size)
+{
+    return bth_slab_alloc(ctx, size);
+}
+
+void *bth_allocator__slab_realloc(void *ctx, void *ptr, size_t old,
+    size_t size)
+{
+    if (!ptr)
+        return bth_slab_alloc(ctx, size);
+
+    // same size class
+    if (old <= BTH_SLAB_MAX && size <= BTH_SLAB_MAX
+        && bth_slab__class(old) == bth_slab__class(size))
+    {
+        return ptr;
+    }
+
+    void *d = bth_slab_alloc(ctx, size);
+
+    memcpy(d, ptr, old < size ? old : size);
+    bth_slab_release(ctx, ptr, old);
+
+    return d;
+}
+
+void bth_allocator__slab_free(void *ctx, void *ptr, size_t size)
+{
+    if (ptr)
+        bth_slab_release(ctx, ptr, size);
+}
+
+struct bth_allocator bth_allocator_slab(struct bth_slab *s)
+{
+    struct bth_allocator a = {
+        .alloc = bth_allocator__slab_alloc,
+        .realloc = bth_allocator__slab_realloc,
+        .free = bth_allocator__slab_free,
+        .ctx = s,
+    };
+
+    return a;
+}
+
+#ifndef __STDC_NO_ATOMICS__
+static _Thread_local struct bth_arena bth_balloc__local;
+// its address identifies the thread
+static _Thread_local char bth_tpool__thread;
+
+struct bth_arena *bth_balloc_local(void)
+{
+    bth_balloc__local.flags = BALLOC_CHUNKED;
+    return &bth_balloc__local;
+}
+
+void bth_balloc_local_free(void)
+{
+    bth_balloc_free(&bth_balloc__local);
+}
+
+void bth_tpool_init(struct bth_tpool *tp, size_t isize)
+{
+    // same rounding as bth_pool_init
+    size_t s = (isize + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+    if (s > (BTH_POOL_PAGE - BTH_ALLOC_CACHELINE) / 8)
+    {
+        errno = EINVAL;
+        BTH_ALLOC_ERR(1, "Cannot make tpool of size %zu", isize);
+    }
+
+    bth_pool_init(&tp->pool, isize, NULL);
+    tp->thread = &bth_tpool__thread;
+    atomic_init(&tp->remote, NULL);
+}
+
+void *bth_tpool_alloc(struct bth_tpool *tp)
+{
+    if (!tp->pool.free
+        && atomic_load_explicit(&tp->remote, memory_order_relaxed))
+    {
+        tp->pool.free = atomic_exchange_explicit(&tp->remote, NULL,
+            memory_order_acquire);
+    }
+
+    return bth_pool_alloc(&tp->pool);
+}
+
+void bth_tpool_release(void *obj)
+{
+    // pool is the first member
+    struct bth_tpool *tp = (struct bth_tpool *)BTH_POOL_OWNER(obj);
+
+    if (tp->thread == &bth_tpool__thread)
+    {
+        bth_pool_release(&tp->pool, obj);
+        return;
+    }
+
+    void *head = atomic_load_explicit(&tp->remote, memory_order_relaxed);
+
+    do
+        *(void **)obj = head;
+    while (!atomic_compare_exchange_weak_explicit(&tp->remote, &head, obj,
+        memory_order_release, memory_order_relaxed));
+}
+
+void bth_tpool_free(struct bth_tpool *tp)
+{
+    bth_pool_free(&tp->pool);
+    atomic_store(&tp->remote, NULL);
+}
+#endif
+
+// padding needed to align the next allocation
+#define BTH_BALLOC__PAD(t, align) \
+    (-(uintptr_t)((char *)(t)->data + (t)->len) & ((align) - 1))
+
 void *bth_balloc(struct bth_arena *t, size_t size)
 {
-    if (t->cap <= t->len + size)
+    return bth_balloc_aligned(t, size, 1);
+}
+
+void *bth_balloc_aligned(struct bth_arena *t, size_t size, size_t align)
+{
+    if (!align || (align & (align - 1)))
+    {
+        errno = EINVAL;
+        BTH_ALLOC_ERR(1, "Invalid balloc alignment %zu", align);
+        return NULL;
+    }
+
+    size_t pad = BTH_BALLOC__PAD(t, align);
+
+    if (t->cap - t->len < size + pad && (t->flags & BALLOC_CHUNKED))
+    {
+        bth_balloc__chain(t, size + align - 1);
+        pad = BTH_BALLOC__PAD(t, align);
+    }
+
+    if (t->cap - t->len < size + pad)
     {
         errno = ENOMEM;
         BTH_ALLOC_ERR(1, "Cannot balloc of size %zu", size);
         return NULL;
     }
 
+    if ((t->flags & BALLOC_VMEM) && !t->prev
+        && t->len + pad + size > t->commit)
+    {
+        bth_balloc__commit(t, t->len + pad + size);
+    }
+
     errno = 0;
-    void *d = (char *)t->data + t->len;
+    void *d = (char *)t->data + t->len + pad;
 
-    t->len += size;
+    t->len += pad + size;
+
+#ifdef BTH_ALLOC_STATS
+    t->used += pad + size;
+    if (t->used > t->hwm)
+        t->hwm = t->used;
+#endif
 
     return d;
 }
+
+void *bth_balloc_array(struct bth_arena *t, size_t n, size_t isize,
+    size_t align)
+{
+    if (isize && n > SIZE_MAX / isize)
+    {
+        errno = ENOMEM;
+        BTH_ALLOC_ERR(1, "Cannot balloc %zu items of size %zu", n, isize);
+        return NULL;
+    }
+
+    return bth_balloc_aligned(t, n * isize, align);
+}
 #endif
 
 #endif /* ! */
@@ -0,0 +1,191 @@
+// MIT No Attribution
+// 
+// Copyright (c) 2025 bobthehuge
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to 
+// deal in the Software without restriction, including without limitation the 
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or 
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef BTH_BLOOM_H
+#define BTH_BLOOM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "bth_alloc.h"
+
+// blocked bloom filter over 64 bits hashes, mixed first so that narrower
+// or weak hashes still spread over all blocks
+// a key only sets and tests bits of one cache line sized block, so a test
+// reads a single cache line
+//
+// blocks = {
+//     [0] = { w0, w1, ..., w7 }  512 bits
+//     .
+//     .
+//     .
+//     [nblocks - 1] = { ... }
+// }
+
+#ifndef BTH_BLOOM_ALLOC
+#define BTH_BLOOM_ALLOC(n) malloc(n)
+#define BTH_BLOOM_FREE(p) free(p)
+#endif
+
+#ifndef BTH_BLOOM_ERRX
+#include <err.h>
+#define BTH_BLOOM_ERRX(c, msg, ...) errx(c, msg, __VA_ARGS__)
+#endif
+
+// filter bits per key, about 1% of false positives at 10
+#ifndef BTH_BLOOM_BITS
+#define BTH_BLOOM_BITS 10
+#endif
+
+#define BTH_BLOOM_BLOCK 64
+// bits set per key, 9 bits of the hash each
+#define BTH_BLOOM_K 7
+
+#define BTH_BLOOM__ALLOC(a, n) \
+    ((a) ? (a)->alloc((a)->ctx, n) : BTH_BLOOM_ALLOC(n))
+#define BTH_BLOOM__FREE(a, p, n) \
+    ((a) ? (a)->free((a)->ctx, p, n) : BTH_BLOOM_FREE(p))
+
+struct bth_bloom
+{
+    size_t n; // keys it was sized for
+    size_t nblocks;
+    uint64_t *blocks; // BTH_BLOOM_BLOCK aligned
+    void *base; // blocks allocation, before alignment
+    const struct bth_allocator *alloc; // BTH_BLOOM_ALLOC & co if NULL
+};
+
+// sized for n keys
+struct bth_bloom *bth_bloom_new(size_t n);
+struct bth_bloom *bth_bloom_new_with(size_t n,
+    const struct bth_allocator *alloc);
+void bth_bloom_free(struct bth_bloom *b);
+void bth_bloom_clear(struct bth_bloom *b);
+
+void bth_bloom_add(struct bth_bloom *b, uint64_t hash);
+// false if hash was never added
+bool bth_bloom_test(const struct bth_bloom *b, uint64_t hash);
+
+uint64_t bth_bloom__mix(uint64_t hash);
+uint64_t *bth_bloom__block(const struct bth_bloom *b, uint64_t hash);
+
+#endif
+
+#if defined(BTH_BLOOM_IMPLEMENTATION) && !defined(__BTH_BLOOM_IMPL)
+// bth_htab.h implements it along with the tables
+#define __BTH_BLOOM_IMPL
+
+#include <string.h>
+
+struct bth_bloom *bth_bloom_new(size_t n)
+{
+    return bth_bloom_new_with(n, NULL);
+}
+
+struct bth_bloom *bth_bloom_new_with(size_t n,
+    const struct bth_allocator *alloc)
+{
+    struct bth_bloom *b = BTH_BLOOM__ALLOC(alloc, sizeof(struct bth_bloom));
+
+    if (!b)
+        return NULL;
+
+    size_t bits = (n ? n : 1) * BTH_BLOOM_BITS;
+
+    b->n = n;
+    b->nblocks = (bits + BTH_BLOOM_BLOCK * 8 - 1) / (BTH_BLOOM_BLOCK * 8);
+    b->alloc = alloc;
+    b->base = BTH_BLOOM__ALLOC(alloc,
+        (b->nblocks + 1) * BTH_BLOOM_BLOCK);
+
+    if (!b->base)
+        BTH_BLOOM_ERRX(1, "Cannot allocate %zu bloom blocks", b->nblocks);
+
+    uintptr_t a = (uintptr_t)b->base + BTH_BLOOM_BLOCK - 1;
+    b->blocks = (uint64_t *)(a & ~(uintptr_t)(BTH_BLOOM_BLOCK - 1));
+    bth_bloom_clear(b);
+
+    return b;
+}
+
+void bth_bloom_free(struct bth_bloom *b)
+{
+    BTH_BLOOM__FREE(b->alloc, b->base, (b->nblocks + 1) * BTH_BLOOM_BLOCK);
+    BTH_BLOOM__FREE(b->alloc, b, sizeof(struct bth_bloom));
+}
+
+void bth_bloom_clear(struct bth_bloom *b)
+{
+    memset(b->blocks, 0, b->nblocks * BTH_BLOOM_BLOCK);
+}
+
+// murmur3 finalizer, every input bit feeds the high bits
+uint64_t bth_bloom__mix(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ull;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+// high bits of the mixed hash pick the block, bits inside come from its
+// product by an odd constant which all of them feed
+uint64_t *bth_bloom__block(const struct bth_bloom *b, uint64_t hash)
+{
+    size_t i = ((hash >> 32) * b->nblocks) >> 32;
+    return b->blocks + i * (BTH_BLOOM_BLOCK / 8);
+}
+
+void bth_bloom_add(struct bth_bloom *b, uint64_t hash)
+{
+    hash = bth_bloom__mix(hash);
+
+    uint64_t *w = bth_bloom__block(b, hash);
+    uint64_t h = hash * 0x9E3779B97F4A7C15ull;
+
+    for (int i = 0; i < BTH_BLOOM_K; i++)
+    {
+        unsigned p = (h >> (1 + 9 * i)) & 511;
+        w[p >> 6] |= (uint64_t)1 << (p & 63);
+    }
+}
+
+bool bth_bloom_test(const struct bth_bloom *b, uint64_t hash)
+{
+    hash = bth_bloom__mix(hash);
+
+    const uint64_t *w = bth_bloom__block(b, hash);
+    uint64_t h = hash * 0x9E3779B97F4A7C15ull;
+
+    for (int i = 0; i < BTH_BLOOM_K; i++)
+    {
+        unsigned p = (h >> (1 + 9 * i)) & 511;
+
+        if (!(w[p >> 6] & (uint64_t)1 << (p & 63)))
+            return false;
+    }
+
+    return true;
+}
+
+#endif
@@ -22,10 +22,14 @@
 
 #include <stdlib.h>
 
+#include "bth_alloc.h"
+
+// data is len + 1 bytes long
 struct bth_cstr
 {
     size_t len;
     char *data;
+    const struct bth_allocator *alloc; // BTH_CSTR_ALLOC & co if NULL
 };
 
 #define BTH_CSTR_AT(cstr, i) (cstr)->data[(i)]
@@ -41,6 +45,11 @@ struct bth_cstr
 #define BTH_CSTR_REALLOC(p, n) realloc(p, n)
 #endif
 
+#define BTH_CSTR__ALLOC(a, n) \
+    ((a) ? (a)->alloc((a)->ctx, n) : BTH_CSTR_ALLOC(n))
+#define BTH_CSTR__REALLOC(a, p, o, n) \
+    ((a) ? (a)->realloc((a)->ctx, p, o, n) : BTH_CSTR_REALLOC(p, n))
+
 #ifndef BTH_CSTR_MEMCPY
 #include <string.h>
 #define BTH_CSTR_MEMCPY(dst, src, n) memcpy(dst, src, n)
@@ -54,6 +63,12 @@ struct bth_cstr
 struct bth_cstr *bth_cstr_new(void);
 struct bth_cstr *bth_cstr_alloc(size_t size);
 struct bth_cstr *bth_cstr_from(char *src);
+// the cstr and its data are allocated through alloc
+struct bth_cstr *bth_cstr_new_with(const struct bth_allocator *alloc);
+struct bth_cstr *bth_cstr_alloc_with(size_t size,
+    const struct bth_allocator *alloc);
+struct bth_cstr *bth_cstr_from_with(char *src,
+    const struct bth_allocator *alloc);
 void bth_cstr_resize(struct bth_cstr *cstr, size_t size);
 void bth_cstr_append(struct bth_cstr *cstr, char *src, size_t n);
 void bth_cstr_cat(struct bth_cstr *dst, struct bth_cstr *src);
@@ -64,31 +79,45 @@ void bth_cstr_cat(struct bth_cstr *dst, struct bth_cstr *src);
 
 struct bth_cstr *bth_cstr_new(void)
 {
-    struct bth_cstr *cstr = BTH_CSTR_ALLOC(sizeof(struct bth_cstr));
+    return bth_cstr_new_with(NULL);
+}
+
+struct bth_cstr *bth_cstr_new_with(const struct bth_allocator *alloc)
+{
+    struct bth_cstr *cstr = BTH_CSTR__ALLOC(alloc, sizeof(struct bth_cstr));
 
     if (cstr == NULL)
     {
-        BTH_CSTR_ERR(1, "Can't allocate cstr");
+        BTH_CSTR_ERR(1, "%s", "Can't allocate cstr");
     }
 
     cstr->len = 0;
-    cstr->data = BTH_CSTR_ALLOC(0);
+    cstr->alloc = alloc;
+    cstr->data = BTH_CSTR__ALLOC(alloc, 1);
+
+    if (cstr->data == NULL)
+    {
+        BTH_CSTR_ERR(1, "Can't allocate cstr data of size '%d'", 1);
+    }
+
+    *cstr->data = 0;
 
     return cstr;
 }
 
 struct bth_cstr *bth_cstr_alloc(size_t size)
 {
-    struct bth_cstr *cstr = bth_cstr_new();
+    return bth_cstr_alloc_with(size, NULL);
+}
 
-    cstr->data = BTH_CSTR_ALLOC(size*sizeof(char));
+struct bth_cstr *bth_cstr_alloc_with(size_t size,
+    const struct bth_allocator *alloc)
+{
+    struct bth_cstr *cstr = bth_cstr_new_with(alloc);
 
-    if (cstr->data == NULL && size != 0)
-    {
-        BTH_CSTR_ERR(1, "Can't allocate cstr data of size '%zu'", size);
-    }
-    else if (size != 0)
+    if (size > 1)
     {
+        bth_cstr_resize(cstr, size);
         cstr->len = size-1;
     }
 
@@ -97,7 +126,8 @@ struct bth_cstr *bth_cstr_alloc(size_t size)
 
 void bth_cstr_resize(struct bth_cstr *cstr, size_t size)
 {
-    char *data = BTH_CSTR_REALLOC(cstr->data, size);
+    char *data = BTH_CSTR__REALLOC(cstr->alloc, cstr->data,
+        cstr->len + 1, size);
 
     if (data == NULL && size != 0)
     {
@@ -117,7 +147,13 @@ void bth_cstr_append(struct bth_cstr *cstr, char *src, size_t n)
 
 struct bth_cstr *bth_cstr_from(char *src)
 {
-    struct bth_cstr *cstr = bth_cstr_new();
+    return bth_cstr_from_with(src, NULL);
+}
+
+struct bth_cstr *bth_cstr_from_with(char *src,
+    const struct bth_allocator *alloc)
+{
+    struct bth_cstr *cstr = bth_cstr_new_with(alloc);
 
     size_t len = BTH_CSTR_STRLEN(src);
     bth_cstr_append(cstr, src, len);
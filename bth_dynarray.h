@@ -20,8 +20,12 @@
 #ifndef BTH_DYNARRAY_H
 #define BTH_DYNARRAY_H
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
+#include "bth_alloc.h"
+
 // total size is isize * cap
 struct bth_dynarray
 {
@@ -32,6 +36,7 @@ struct bth_dynarray
     // allocated capacity (not total size)
     size_t cap;
     void *items;
+    const struct bth_allocator *alloc; // BTH_DYNARRAY_ALLOC & co if NULL
 };
 
 #ifndef BTH_DYNARRAY_ERRX
@@ -45,34 +50,636 @@ struct bth_dynarray
 #define BTH_DYNARRAY_REALLOC(p, n) realloc(p, n)
 #endif
 
+#define BTH_DYNARRAY__ALLOC(a, n) \
+    ((a) ? (a)->alloc((a)->ctx, n) : BTH_DYNARRAY_ALLOC(n))
+#define BTH_DYNARRAY__REALLOC(a, p, o, n) \
+    ((a) ? (a)->realloc((a)->ctx, p, o, n) : BTH_DYNARRAY_REALLOC(p, n))
+#define BTH_DYNARRAY__FREE(a, p, n) \
+    ((a) ? (a)->free((a)->ctx, p, n) : BTH_DYNARRAY_FREE(p))
+
+// capacity after c when appending to a full dynarray, must be > c
+// ((c) < 4 ? 4 : (c) + (c) / 2) for 1.5x growth
+#ifndef BTH_DYNARRAY_GROW
+#define BTH_DYNARRAY_GROW(c) ((c) < 4 ? 4 : (c) * 2)
+#endif
+
 #ifndef BTH_DYNARRAY_MEMCPY
 #include <string.h>
 #define BTH_DYNARRAY_MEMCPY(dst, src, n) memcpy(dst, src, n)
 #endif
 
+#ifndef BTH_DYNARRAY_MEMMOVE
+#include <string.h>
+#define BTH_DYNARRAY_MEMMOVE(dst, src, n) memmove(dst, src, n)
+#endif
+
 struct bth_dynarray bth_dynarray_init(size_t isize, size_t prealloc);
+struct bth_dynarray bth_dynarray_init_with(size_t isize, size_t prealloc,
+    const struct bth_allocator *alloc);
+void bth_dynarray_free(struct bth_dynarray *da);
+void bth_dynarray_resize(struct bth_dynarray *da, size_t n);
+// make room for at least n items, never shrinks
+void bth_dynarray_reserve(struct bth_dynarray *da, size_t n);
+// release capacity past len
+void bth_dynarray_shrink_to_fit(struct bth_dynarray *da);
 void bth_dynarray_get(struct bth_dynarray *da, size_t index, void *e);
 void bth_dynarray_set(struct bth_dynarray *da, size_t index, void *e);
 void bth_dynarray_append(struct bth_dynarray *da, void *e);
 void bth_dynarray_pop(struct bth_dynarray *da, void *e);
 
+// pointer to the item at index, valid until the next resize
+void *bth_dynarray_at(struct bth_dynarray *da, size_t index);
+// append n items from src, which may point into da
+void bth_dynarray_extend(struct bth_dynarray *da, const void *src, size_t n);
+// insert n items from src before index, index can be len, src may point
+// into da
+void bth_dynarray_insert(struct bth_dynarray *da, size_t index,
+    const void *src, size_t n);
+// remove n items from index on, keeping the order of the others
+void bth_dynarray_erase(struct bth_dynarray *da, size_t index, size_t n);
+// remove the item at index by moving the last one there
+// the item is stored in e if not NULL
+void bth_dynarray_swap_remove(struct bth_dynarray *da, size_t index, void *e);
+
+// LSD radix sort on an integer key of ksize bytes (at most 8) stored at
+// offset koff of every item, two's complement if sign, stable
+// bytes that are the same in every key are skipped
+void bth_dynarray_radix_sort(struct bth_dynarray *da, size_t koff,
+    size_t ksize, bool sign);
+// same on n items of isize bytes at items, e.g. typed dynarrays or columns
+void bth_dynarray_radix_sortn(void *items, size_t n, size_t isize,
+    size_t koff, size_t ksize, bool sign, const struct bth_allocator *alloc);
+
+// make room for n more items, growing by BTH_DYNARRAY_GROW at least
+void bth_dynarray__grow(struct bth_dynarray *da, size_t n);
+
+// copy sz bytes of src at items + at, after a gap of sz bytes was opened
+// there by moving the bytes from at on
+// if src was at offset off of items before (inside), it is read from the
+// new items, the part of it that was moved sz bytes further
+static inline void bth_dynarray__fill(char *items, size_t at, size_t sz,
+    const void *src, bool inside, size_t off)
+{
+    if (!inside)
+    {
+        BTH_DYNARRAY_MEMCPY(items + at, src, sz);
+        return;
+    }
+
+    size_t before = off < at ? at - off : 0;
+
+    if (before > sz)
+        before = sz;
+
+    BTH_DYNARRAY_MEMCPY(items + at, items + off, before);
+    BTH_DYNARRAY_MEMCPY(items + at + before, items + off + before + sz,
+        sz - before);
+}
+
+// bounds checks of typed dynarrays, gone with NDEBUG
+#ifndef BTH_DYNARRAY_ASSERT
+#include <assert.h>
+#define BTH_DYNARRAY_ASSERT(c) assert(c)
+#endif
+
+// dynarray of T with the item size known at compile time
+// items are accessed in place and every function is inlined
+//
+// BTH_DYNARRAY_TYPEDEF(Floats, float);
+// Floats v;
+// Floats_init(&v, 0);
+// Floats_append(&v, 1.0f);
+// for (size_t i = 0; i < v.len; i++)
+//     v.items[i] *= 2;
+//
+// item pointers are valid until the next resize
+
+#define BTH_DYNARRAY_TYPEDEF(name, T) \
+typedef struct \
+{ \
+    size_t len; \
+    size_t cap; \
+    T *items; \
+    const struct bth_allocator *alloc; /* BTH_DYNARRAY_ALLOC & co if NULL */ \
+} name; \
+\
+static inline void name##_resize(name *v, size_t n) \
+{ \
+    T *items = BTH_DYNARRAY__REALLOC(v->alloc, v->items, \
+        v->cap * sizeof(T), n * sizeof(T)); \
+\
+    if (!items && n) \
+    { \
+        BTH_DYNARRAY_ERRX(1, "Cannot realloc %zu items of " #name, n); \
+    } \
+\
+    v->items = items; \
+    v->len = n > v->len ? v->len : n; \
+    v->cap = n; \
+} \
+\
+static inline void name##_init_with(name *v, size_t prealloc, \
+    const struct bth_allocator *alloc) \
+{ \
+    v->len = 0; \
+    v->cap = 0; \
+    v->items = NULL; \
+    v->alloc = alloc; \
+\
+    if (prealloc) \
+        name##_resize(v, prealloc); \
+} \
+\
+static inline void name##_init(name *v, size_t prealloc) \
+{ \
+    name##_init_with(v, prealloc, NULL); \
+} \
+\
+static inline void name##_free(name *v) \
+{ \
+    BTH_DYNARRAY__FREE(v->alloc, v->items, v->cap * sizeof(T)); \
+    v->items = NULL; \
+    v->cap = 0; \
+    v->len = 0; \
+} \
+\
+static inline void name##_reserve(name *v, size_t n) \
+{ \
+    if (n > v->cap) \
+        name##_resize(v, n); \
+} \
+\
+static inline void name##_shrink_to_fit(name *v) \
+{ \
+    if (v->len < v->cap) \
+        name##_resize(v, v->len); \
+} \
+\
+static inline T *name##_at(name *v, size_t index) \
+{ \
+    BTH_DYNARRAY_ASSERT(index < v->len); \
+    return v->items + index; \
+} \
+\
+static inline T name##_get(const name *v, size_t index) \
+{ \
+    BTH_DYNARRAY_ASSERT(index < v->len); \
+    return v->items[index]; \
+} \
+\
+static inline void name##_set(name *v, size_t index, T e) \
+{ \
+    BTH_DYNARRAY_ASSERT(index < v->len); \
+    v->items[index] = e; \
+} \
+\
+static inline void name##_append(name *v, T e) \
+{ \
+    if (v->len >= v->cap) \
+        name##_resize(v, BTH_DYNARRAY_GROW(v->cap)); \
+\
+    v->items[v->len++] = e; \
+} \
+\
+static inline T name##_pop(name *v) \
+{ \
+    BTH_DYNARRAY_ASSERT(v->len); \
+    return v->items[--v->len]; \
+} \
+\
+static inline void name##__grow(name *v, size_t n) \
+{ \
+    if (v->len + n <= v->cap) \
+        return; \
+\
+    size_t cap = BTH_DYNARRAY_GROW(v->cap); \
+    name##_resize(v, cap < v->len + n ? v->len + n : cap); \
+} \
+\
+/* src may point into v */ \
+static inline void name##_insert(name *v, size_t index, const T *src, \
+    size_t n) \
+{ \
+    BTH_DYNARRAY_ASSERT(index <= v->len); \
+\
+    if (!n) \
+        return; \
+\
+    size_t off = (uintptr_t)src - (uintptr_t)v->items; \
+    bool inside = off < v->len * sizeof(T); \
+\
+    name##__grow(v, n); \
+    BTH_DYNARRAY_MEMMOVE(v->items + index + n, v->items + index, \
+        (v->len - index) * sizeof(T)); \
+    bth_dynarray__fill((char *)v->items, index * sizeof(T), n * sizeof(T), \
+        src, inside, off); \
+    v->len += n; \
+} \
+\
+static inline void name##_extend(name *v, const T *src, size_t n) \
+{ \
+    name##_insert(v, v->len, src, n); \
+} \
+\
+static inline void name##_erase(name *v, size_t index, size_t n) \
+{ \
+    BTH_DYNARRAY_ASSERT(index <= v->len && n <= v->len - index); \
+\
+    if (!n) \
+        return; \
+\
+    BTH_DYNARRAY_MEMMOVE(v->items + index, v->items + index + n, \
+        (v->len - index - n) * sizeof(T)); \
+    v->len -= n; \
+} \
+\
+static inline T name##_swap_remove(name *v, size_t index) \
+{ \
+    BTH_DYNARRAY_ASSERT(index < v->len); \
+    T e = v->items[index]; \
+    v->items[index] = v->items[--v->len]; \
+    return e; \
+}
+
+// structure of arrays, with one typed column per field and a shared len
+// FIELDS(X) expands X(type, field) for every field
+//
+// #define EVENT_FIELDS(X) X(uint64_t, ts) X(int, kind)
+// BTH_DYNARRAY_SOA_TYPEDEF(Events, EVENT_FIELDS);
+// Events ev;
+// Events_init(&ev, 0);
+// Events_push(&ev, (Events_row){.ts = 42, .kind = 1});
+// for (size_t i = 0; i < ev.len; i++)
+//     total += ev.ts[i];
+//
+// columns are plain arrays of len items, valid until the next resize
+
+#define BTH_DYNARRAY__SOA_FIELD(T, f) T f;
+#define BTH_DYNARRAY__SOA_COLUMN(T, f) T *f;
+#define BTH_DYNARRAY__SOA_NULL(T, f) v->f = NULL;
+#define BTH_DYNARRAY__SOA_RESIZE(T, f) \
+    v->f = BTH_DYNARRAY__REALLOC(v->alloc, v->f, \
+        v->cap * sizeof(T), n * sizeof(T)); \
+    if (!v->f && n) \
+        BTH_DYNARRAY_ERRX(1, "Cannot realloc %zu items of column " #f, n);
+#define BTH_DYNARRAY__SOA_FREE(T, f) \
+    BTH_DYNARRAY__FREE(v->alloc, v->f, v->cap * sizeof(T)); \
+    v->f = NULL;
+#define BTH_DYNARRAY__SOA_STORE(T, f) v->f[index] = r.f;
+#define BTH_DYNARRAY__SOA_LOAD(T, f) r.f = v->f[index];
+
+#define BTH_DYNARRAY_SOA_TYPEDEF(name, FIELDS) \
+typedef struct { FIELDS(BTH_DYNARRAY__SOA_FIELD) } name##_row; \
+typedef struct \
+{ \
+    size_t len; \
+    size_t cap; \
+    FIELDS(BTH_DYNARRAY__SOA_COLUMN) \
+    const struct bth_allocator *alloc; /* BTH_DYNARRAY_ALLOC & co if NULL */ \
+} name; \
+\
+static inline void name##_resize(name *v, size_t n) \
+{ \
+    FIELDS(BTH_DYNARRAY__SOA_RESIZE) \
+    v->len = n > v->len ? v->len : n; \
+    v->cap = n; \
+} \
+\
+static inline void name##_init_with(name *v, size_t prealloc, \
+    const struct bth_allocator *alloc) \
+{ \
+    v->len = 0; \
+    v->cap = 0; \
+    FIELDS(BTH_DYNARRAY__SOA_NULL) \
+    v->alloc = alloc; \
+\
+    if (prealloc) \
+        name##_resize(v, prealloc); \
+} \
+\
+static inline void name##_init(name *v, size_t prealloc) \
+{ \
+    name##_init_with(v, prealloc, NULL); \
+} \
+\
+static inline void name##_free(name *v) \
+{ \
+    FIELDS(BTH_DYNARRAY__SOA_FREE) \
+    v->cap = 0; \
+    v->len = 0; \
+} \
+\
+static inline void name##_reserve(name *v, size_t n) \
+{ \
+    if (n > v->cap) \
+        name##_resize(v, n); \
+} \
+\
+static inline name##_row name##_get(const name *v, size_t index) \
+{ \
+    name##_row r; \
+\
+    BTH_DYNARRAY_ASSERT(index < v->len); \
+    FIELDS(BTH_DYNARRAY__SOA_LOAD) \
+\
+    return r; \
+} \
+\
+static inline void name##_set(name *v, size_t index, name##_row r) \
+{ \
+    BTH_DYNARRAY_ASSERT(index < v->len); \
+    FIELDS(BTH_DYNARRAY__SOA_STORE) \
+} \
+\
+static inline void name##_push(name *v, name##_row r) \
+{ \
+    if (v->len >= v->cap) \
+        name##_resize(v, BTH_DYNARRAY_GROW(v->cap)); \
+\
+    size_t index = v->len++; \
+    FIELDS(BTH_DYNARRAY__SOA_STORE) \
+} \
+\
+static inline name##_row name##_pop(name *v) \
+{ \
+    name##_row r = name##_get(v, v->len - 1); \
+\
+    v->len--; \
+    return r; \
+}
+
+// runs this short are sorted by insertion
+#ifndef BTH_DYNARRAY_SORT_SMALL
+#define BTH_DYNARRAY_SORT_SMALL 16
+#endif
+
+#define BTH_DYNARRAY_LESS(a, b) ((a) < (b))
+
+// stable merge sort and binary searches over arrays of T sorted by less(a, b)
+// which is expanded in place
+//
+// BTH_DYNARRAY_TYPEDEF(Floats, float);
+// BTH_DYNARRAY_SORT(Floats, float, BTH_DYNARRAY_LESS);
+// Floats_sort(v.items, v.len);
+// size_t i = Floats_lower_bound(v.items, v.len, 1.0f);
+//
+// lower_bound is the first item not less than key, upper_bound the first
+// item greater than it, n if there is none
+
+#define BTH_DYNARRAY_SORT(name, T, less) \
+static inline void name##__isort(T *a, size_t n) \
+{ \
+    for (size_t i = 1; i < n; i++) \
+    { \
+        T x = a[i]; \
+        size_t j = i; \
+\
+        for (; j && (less(x, a[j - 1])); j--) \
+            a[j] = a[j - 1]; \
+\
+        a[j] = x; \
+    } \
+} \
+\
+/* merge sorted a[0, mid[ and a[mid, n[ through tmp */ \
+static inline void name##__merge(T *a, T *tmp, size_t mid, size_t n) \
+{ \
+    size_t i = 0; \
+    size_t j = mid; \
+    size_t k = 0; \
+\
+    if (!mid || mid == n || !(less(a[mid], a[mid - 1]))) \
+        return; \
+\
+    while (i < mid && j < n) \
+        tmp[k++] = (less(a[j], a[i])) ? a[j++] : a[i++]; \
+\
+    while (i < mid) \
+        tmp[k++] = a[i++]; \
+\
+    /* the rest of a[mid, n[ is already in place */ \
+    BTH_DYNARRAY_MEMCPY(a, tmp, k * sizeof(T)); \
+} \
+\
+static inline void name##__msort(T *a, T *tmp, size_t n) \
+{ \
+    if (n <= BTH_DYNARRAY_SORT_SMALL) \
+    { \
+        name##__isort(a, n); \
+        return; \
+    } \
+\
+    name##__msort(a, tmp, n / 2); \
+    name##__msort(a + n / 2, tmp + n / 2, n - n / 2); \
+    name##__merge(a, tmp, n / 2, n); \
+} \
+\
+static inline void name##_sort(T *a, size_t n) \
+{ \
+    if (n <= BTH_DYNARRAY_SORT_SMALL) \
+    { \
+        name##__isort(a, n); \
+        return; \
+    } \
+\
+    T *tmp = BTH_DYNARRAY_ALLOC(n * sizeof(T)); \
+\
+    if (!tmp) \
+        BTH_DYNARRAY_ERRX(1, "Cannot allocate %zu items to sort " #name, n); \
+\
+    name##__msort(a, tmp, n); \
+    BTH_DYNARRAY_FREE(tmp); \
+} \
+\
+static inline size_t name##_lower_bound(const T *a, size_t n, T key) \
+{ \
+    size_t lo = 0; \
+\
+    while (n) \
+    { \
+        size_t h = n / 2; \
+\
+        if (less(a[lo + h], key)) \
+        { \
+            lo += h + 1; \
+            n -= h + 1; \
+        } \
+        else \
+            n = h; \
+    } \
+\
+    return lo; \
+} \
+\
+static inline size_t name##_upper_bound(const T *a, size_t n, T key) \
+{ \
+    size_t lo = 0; \
+\
+    while (n) \
+    { \
+        size_t h = n / 2; \
+\
+        if (!(less(key, a[lo + h]))) \
+        { \
+            lo += h + 1; \
+            n -= h + 1; \
+        } \
+        else \
+            n = h; \
+    } \
+\
+    return lo; \
+} \
+\
+/* an item equal to key, NULL if none */ \
+static inline T *name##_bsearch(T *a, size_t n, T key) \
+{ \
+    size_t i = name##_lower_bound(a, n, key); \
+    return i < n && !(less(key, a[i])) ? a + i : NULL; \
+}
+
+#ifdef BTH_DYNARRAY_PARALLEL
+
+#include <pthread.h>
+#include <stdbool.h>
+
+// most threads used by a parallel sort
+#ifndef BTH_DYNARRAY_PSORT_THREADS
+#define BTH_DYNARRAY_PSORT_THREADS 64
+#endif
+
+// fewest items sorted by a thread
+#ifndef BTH_DYNARRAY_PSORT_MIN
+#define BTH_DYNARRAY_PSORT_MIN 16384
+#endif
+
+// name##_psort(a, n, nthreads) on top of BTH_DYNARRAY_SORT(name, T, less)
+// every thread sorts a slice, then pairs of slices are merged in parallel
+// until one is left
+//
+// BTH_DYNARRAY_PSORT(Floats, float, BTH_DYNARRAY_LESS);
+// Floats_psort(v.items, v.len, 8);
+
+#define BTH_DYNARRAY_PSORT(name, T, less) \
+typedef struct \
+{ \
+    T *a; \
+    T *tmp; \
+    size_t mid; /* 0 to sort, else merge */ \
+    size_t n; \
+} name##__part; \
+\
+static inline void *name##__run(void *arg) \
+{ \
+    name##__part *p = arg; \
+\
+    if (p->mid) \
+        name##__merge(p->a, p->tmp, p->mid, p->n); \
+    else \
+        name##__msort(p->a, p->tmp, p->n); \
+\
+    return NULL; \
+} \
+\
+/* run parts on threads, inline if one cannot be started */ \
+static inline void name##__spawn(name##__part *parts, size_t np) \
+{ \
+    pthread_t th[BTH_DYNARRAY_PSORT_THREADS]; \
+    bool started[BTH_DYNARRAY_PSORT_THREADS]; \
+\
+    for (size_t i = 0; i < np; i++) \
+    { \
+        started[i] = !pthread_create(th + i, NULL, name##__run, parts + i); \
+\
+        if (!started[i]) \
+            name##__run(parts + i); \
+    } \
+\
+    for (size_t i = 0; i < np; i++) \
+    { \
+        if (started[i]) \
+            pthread_join(th[i], NULL); \
+    } \
+} \
+\
+static inline void name##_psort(T *a, size_t n, size_t nthreads) \
+{ \
+    name##__part parts[BTH_DYNARRAY_PSORT_THREADS]; \
+    size_t t = 1; \
+\
+    /* power of 2 slices so that they merge in pairs */ \
+    while (t * 2 <= nthreads && t * 2 <= BTH_DYNARRAY_PSORT_THREADS \
+        && n / (t * 2) >= BTH_DYNARRAY_PSORT_MIN) \
+    { \
+        t *= 2; \
+    } \
+\
+    if (t == 1) \
+    { \
+        name##_sort(a, n); \
+        return; \
+    } \
+\
+    T *tmp = BTH_DYNARRAY_ALLOC(n * sizeof(T)); \
+\
+    if (!tmp) \
+        BTH_DYNARRAY_ERRX(1, "Cannot allocate %zu items to sort " #name, n); \
+\
+    for (size_t i = 0; i < t; i++) \
+    { \
+        size_t lo = i * n / t; \
+        size_t hi = (i + 1) * n / t; \
+\
+        parts[i] = (name##__part){a + lo, tmp + lo, 0, hi - lo}; \
+    } \
+\
+    name##__spawn(parts, t); \
+\
+    for (size_t w = 1; w < t; w *= 2) \
+    { \
+        size_t np = 0; \
+\
+        for (size_t i = 0; i < t; i += 2 * w) \
+        { \
+            size_t lo = i * n / t; \
+            size_t mid = (i + w) * n / t; \
+            size_t hi = (i + 2 * w) * n / t; \
+\
+            parts[np++] = (name##__part){a + lo, tmp + lo, mid - lo, hi - lo}; \
+        } \
+\
+        name##__spawn(parts, np); \
+    } \
+\
+    BTH_DYNARRAY_FREE(tmp); \
+}
+
+#endif
+
 #endif
 
 #ifdef BTH_DYNARRAY_IMPLEMENTATION
 
 struct bth_dynarray bth_dynarray_init(size_t isize, size_t prealloc)
 {
-    void *data = BTH_DYNARRAY_ALLOC(isize * prealloc);
+    return bth_dynarray_init_with(isize, prealloc, NULL);
+}
+
+struct bth_dynarray bth_dynarray_init_with(size_t isize, size_t prealloc,
+    const struct bth_allocator *alloc)
+{
+    void *data = BTH_DYNARRAY__ALLOC(alloc, isize * prealloc);
 
     if (!data && prealloc)
-        BTHBTH_DYNARRAY_ERRX(1,
-            "Cannot prealloc %d items for dynarray", prealloc);
+        BTH_DYNARRAY_ERRX(1,
+            "Cannot prealloc %zu items for dynarray", prealloc);
 
     struct bth_dynarray da = {
         .len = 0,
         .isize = isize,
         .cap = prealloc,
         .items = data,
+        .alloc = alloc,
     };
 
     return da;
@@ -80,19 +687,21 @@ struct bth_dynarray bth_dynarray_init(size_t isize, size_t prealloc)
 
 void bth_dynarray_free(struct bth_dynarray *da)
 {
-    BTH_DYNARRAY_FREE(da->items);
+    BTH_DYNARRAY__FREE(da->alloc, da->items, da->isize * da->cap);
+    da->items = NULL;
     da->cap = 0;
     da->len = 0;
 }
 
 void bth_dynarray_resize(struct bth_dynarray *da, size_t n)
 {
-    void *data = BTH_DYNARRAY_REALLOC(da->items, da->isize * n);
+    void *data = BTH_DYNARRAY__REALLOC(da->alloc, da->items,
+        da->isize * da->cap, da->isize * n);
 
     if (!data && n)
     {
         BTH_DYNARRAY_ERRX(1, 
-             "Cannot realloc %d items of size %d for dynarray",
+             "Cannot realloc %zu items of size %zu for dynarray",
              n, da->isize);
     }
 
@@ -101,10 +710,22 @@ void bth_dynarray_resize(struct bth_dynarray *da, size_t n)
     da->cap = n;
 }
 
+void bth_dynarray_reserve(struct bth_dynarray *da, size_t n)
+{
+    if (n > da->cap)
+        bth_dynarray_resize(da, n);
+}
+
+void bth_dynarray_shrink_to_fit(struct bth_dynarray *da)
+{
+    if (da->len < da->cap)
+        bth_dynarray_resize(da, da->len);
+}
+
 void bth_dynarray_get(struct bth_dynarray *da, size_t index, void *e)
 {
     if (index >= da->len)
-        BTH_DYNARRAY_ERRX(1, "Index out of bound of dynarray");
+        BTH_DYNARRAY_ERRX(1, "%s", "Index out of bound of dynarray");
 
     char *start = da->items;
     BTH_DYNARRAY_MEMCPY(e, start + index * da->isize, da->isize);
@@ -113,7 +734,7 @@ void bth_dynarray_get(struct bth_dynarray *da, size_t index, void *e)
 void bth_dynarray_set(struct bth_dynarray *da, size_t index, void *e)
 {
     if (index >= da->len)
-        BTH_DYNARRAY_ERRX(1, "Index out of bound of dynarray");
+        BTH_DYNARRAY_ERRX(1, "%s", "Index out of bound of dynarray");
 
     char *start = da->items;
     BTH_DYNARRAY_MEMCPY(start + index * da->isize, e, da->isize);
@@ -122,7 +743,7 @@ void bth_dynarray_set(struct bth_dynarray *da, size_t index, void *e)
 void bth_dynarray_append(struct bth_dynarray *da, void *e)
 {
     if (da->len >= da->cap)
-        bth_dynarray_resize(da, da->cap + 1);
+        bth_dynarray_resize(da, BTH_DYNARRAY_GROW(da->cap));
 
     da->len++;
     bth_dynarray_set(da, da->len - 1, e);
@@ -131,7 +752,7 @@ void bth_dynarray_append(struct bth_dynarray *da, void *e)
 void bth_dynarray_pop(struct bth_dynarray *da, void *e)
 {
     if (!da->len)
-        BTH_DYNARRAY_ERRX(1, "Invalid pop on empty dynarray");
+        BTH_DYNARRAY_ERRX(1, "%s", "Invalid pop on empty dynarray");
 
     if (e)
         bth_dynarray_get(da, da->len - 1, e);
@@ -139,4 +760,180 @@ void bth_dynarray_pop(struct bth_dynarray *da, void *e)
     da->len--;
 }
 
+void *bth_dynarray_at(struct bth_dynarray *da, size_t index)
+{
+    if (index >= da->len)
+        BTH_DYNARRAY_ERRX(1, "%s", "Index out of bound of dynarray");
+
+    return (char *)da->items + index * da->isize;
+}
+
+void bth_dynarray_radix_sort(struct bth_dynarray *da, size_t koff,
+    size_t ksize, bool sign)
+{
+    bth_dynarray_radix_sortn(da->items, da->len, da->isize, koff, ksize,
+        sign, da->alloc);
+}
+
+// offset of byte d of a key, from the least significant one
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define BTH_DYNARRAY__DIGIT(d, ksize) ((ksize) - 1 - (d))
+#else
+#define BTH_DYNARRAY__DIGIT(d, ksize) (d)
+#endif
+
+// flipping the sign bit orders two's complement keys as unsigned ones
+#define BTH_DYNARRAY__FLIP(d, ksize, sign) \
+    ((sign) && (d) == (ksize) - 1 ? 0x80 : 0)
+
+void bth_dynarray_radix_sortn(void *items, size_t n, size_t isize,
+    size_t koff, size_t ksize, bool sign, const struct bth_allocator *alloc)
+{
+    size_t count[8][256] = {0};
+
+    if (ksize > 8)
+        BTH_DYNARRAY_ERRX(1, "Radix sort key of %zu bytes is too wide", ksize);
+
+    if (n < 2)
+        return;
+
+    unsigned char *src = items;
+
+    // histograms of every byte at once
+    for (size_t i = 0; i < n; i++)
+    {
+        const unsigned char *k = src + i * isize + koff;
+
+        for (size_t d = 0; d < ksize; d++)
+        {
+            unsigned char f = BTH_DYNARRAY__FLIP(d, ksize, sign);
+            count[d][k[BTH_DYNARRAY__DIGIT(d, ksize)] ^ f]++;
+        }
+    }
+
+    unsigned char *tmp = NULL;
+    unsigned char *dst = NULL;
+
+    for (size_t d = 0; d < ksize; d++)
+    {
+        size_t off = koff + BTH_DYNARRAY__DIGIT(d, ksize);
+        unsigned char f = BTH_DYNARRAY__FLIP(d, ksize, sign);
+
+        if (count[d][src[off] ^ f] == n)
+            continue;
+
+        if (!tmp)
+        {
+            tmp = BTH_DYNARRAY__ALLOC(alloc, n * isize);
+
+            if (!tmp)
+            {
+                BTH_DYNARRAY_ERRX(1,
+                    "Cannot allocate %zu items for radix sort", n);
+            }
+
+            dst = tmp;
+        }
+
+        size_t pos = 0;
+
+        for (size_t b = 0; b < 256; b++)
+        {
+            size_t c = count[d][b];
+
+            count[d][b] = pos;
+            pos += c;
+        }
+
+        for (size_t i = 0; i < n; i++)
+        {
+            const unsigned char *e = src + i * isize;
+            size_t to = count[d][e[off] ^ f]++;
+
+            BTH_DYNARRAY_MEMCPY(dst + to * isize, e, isize);
+        }
+
+        unsigned char *t = src;
+
+        src = dst;
+        dst = t;
+    }
+
+    if (src != items)
+        BTH_DYNARRAY_MEMCPY(items, src, n * isize);
+
+    if (tmp)
+        BTH_DYNARRAY__FREE(alloc, tmp, n * isize);
+}
+
+void bth_dynarray__grow(struct bth_dynarray *da, size_t n)
+{
+    if (da->len + n <= da->cap)
+        return;
+
+    size_t cap = BTH_DYNARRAY_GROW(da->cap);
+    bth_dynarray_resize(da, cap < da->len + n ? da->len + n : cap);
+}
+
+void bth_dynarray_extend(struct bth_dynarray *da, const void *src, size_t n)
+{
+    bth_dynarray_insert(da, da->len, src, n);
+}
+
+void bth_dynarray_insert(struct bth_dynarray *da, size_t index,
+    const void *src, size_t n)
+{
+    if (index > da->len)
+        BTH_DYNARRAY_ERRX(1, "%s", "Index out of bound of dynarray");
+
+    if (!n)
+        return;
+
+    // growing may move src along with items
+    size_t off = (uintptr_t)src - (uintptr_t)da->items;
+    bool inside = off < da->len * da->isize;
+
+    bth_dynarray__grow(da, n);
+
+    char *pos = (char *)da->items + index * da->isize;
+    BTH_DYNARRAY_MEMMOVE(pos + n * da->isize, pos,
+        (da->len - index) * da->isize);
+    bth_dynarray__fill(da->items, index * da->isize, n * da->isize, src,
+        inside, off);
+    da->len += n;
+}
+
+void bth_dynarray_erase(struct bth_dynarray *da, size_t index, size_t n)
+{
+    if (index > da->len || n > da->len - index)
+        BTH_DYNARRAY_ERRX(1, "%s", "Range out of bound of dynarray");
+
+    if (!n)
+        return;
+
+    char *pos = (char *)da->items + index * da->isize;
+    BTH_DYNARRAY_MEMMOVE(pos, pos + n * da->isize,
+        (da->len - index - n) * da->isize);
+    da->len -= n;
+}
+
+void bth_dynarray_swap_remove(struct bth_dynarray *da, size_t index, void *e)
+{
+    if (index >= da->len)
+        BTH_DYNARRAY_ERRX(1, "%s", "Index out of bound of dynarray");
+
+    char *pos = (char *)da->items + index * da->isize;
+
+    if (e)
+        BTH_DYNARRAY_MEMCPY(e, pos, da->isize);
+
+    da->len--;
+
+    if (index != da->len)
+    {
+        BTH_DYNARRAY_MEMCPY(pos, (char *)da->items + da->len * da->isize,
+            da->isize);
+    }
+}
+
 #endif
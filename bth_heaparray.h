@@ -22,6 +22,8 @@
 
 #include <stdlib.h>
 
+#include "bth_alloc.h"
+
 // https://en.wikipedia.org/wiki/D-ary_heap
 // https://en.wikipedia.org/wiki/Binary_heap
 
@@ -52,6 +54,9 @@
 #define BTH_HEAPARRAY_ERRNO 0xFF
 #endif
 
+#define BTH_HEAPARRAY__REALLOC(a, p, o, n) \
+    ((a) ? (a)->realloc((a)->ctx, p, o, n) : BTH_HEAPARRAY_REALLOC(p, n))
+
 struct bth_heap_elt
 {
     size_t value;
@@ -65,6 +70,7 @@ struct bth_heaparray
     size_t len;
     char flags;
     struct bth_heap_elt *elts;
+    const struct bth_allocator *alloc; // BTH_HEAPARRAY_REALLOC if NULL
 };
 
 int bth_heap_resize(struct bth_heaparray *heap, size_t n);
@@ -84,8 +90,9 @@ int bth_heap_resize(struct bth_heaparray *heap, size_t n)
     if (BTH_HEAP_FLAG(heap->flags, HEAP_NOEXPAND | HEAP_CANFAIL))
         return -HEAP_NOEXPAND;
 
-    void *tmp =
-        BTH_HEAPARRAY_REALLOC(heap->elts, sizeof(struct bth_heap_elt) * n);
+    void *tmp = BTH_HEAPARRAY__REALLOC(heap->alloc, heap->elts,
+        sizeof(struct bth_heap_elt) * heap->cap,
+        sizeof(struct bth_heap_elt) * n);
 
     if (tmp == NULL && n != 0 && BTH_HEAP_FLAG(heap->flags, HEAP_CANFAIL))
         return BTH_HEAPARRAY_ERRNO;
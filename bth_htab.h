@@ -46,50 +46,132 @@
 #ifndef BTH_HTAB_H
 #define BTH_HTAB_H
 
+#include <errno.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 
+#include "bth_alloc.h"
+
+#if defined(BTH_HTAB_IMPLEMENTATION) && !defined(BTH_BLOOM_IMPLEMENTATION)
+#define BTH_BLOOM_IMPLEMENTATION
+#endif
+
+#include "bth_bloom.h"
+
 struct bth_hdata
 {
     uint64_t hash;
-    const char *key;
+    const char *key; // NUL terminated copy
+    size_t klen; // key length without the NUL
     void *value;
 };
 
+// idx is allocated on the first put into the bucket, NULL while cap is 0
 struct bth_hbuck
 {
     uint64_t cap;
     size_t *idx;
 };
 
+// pooled tables carve entries out of these, the key following its entry in
+// a room of (class + 1) * 16 bytes
+//
+// | prev, cap, len | {hash, key, klen, value} "key\0" ... | {...} ... | ...
+//
+// released entries are linked through value on the list of their class
+struct bth_hblock
+{
+    struct bth_hblock *prev;
+    size_t cap; // bytes, header included
+    size_t len; // offset of the next entry
+};
+
+// key size classes of pooled tables, entries of longer keys are allocated
+// on their own
+#ifndef BTH_HTAB_CLASSES
+#define BTH_HTAB_CLASSES 8
+#endif
+
+#define BTH_HTAB__CLASS(len) (((len) + 16) / 16 - 1)
+
 struct bth_htab
 {
     bool noresize; // do not resize data array when full
+    // entries and keys are carved from table owned blocks, deleted ones are
+    // reused by the next puts of the same key size class, the blocks are
+    // only released by reset or free (set before the first put)
+    bool pooled;
+    // recap moves BTH_HTAB_REHASH_STEP buckets per operation instead of all
+    // of them at once, and the map grows past BTH_HTAB_MAXLOAD
+    bool incremental;
     size_t cap; // map rows
     size_t size; // data len
     size_t nb; // additionnal elements to realloc when resizing bucket indices
     size_t nd; // additionnal elements to realloc when resizing data
     struct bth_hdata **data;
     struct bth_hbuck *map;
+    const struct bth_allocator *alloc; // BTH_HTAB_ALLOC & co if NULL
+    size_t top; // data slots from top on were never used
+    size_t *free; // stack of released data slots below top
+    size_t nfree;
+    size_t freecap;
+    size_t count; // live entries
+    struct bth_hbuck *omap; // map being migrated by an incremental recap
+    size_t ocap;
+    size_t rpos; // omap buckets below rpos were migrated
+    struct bth_hblock *blocks; // last block of a pooled table
+    struct bth_hdata *pfree[BTH_HTAB_CLASSES]; // released pooled entries
+    size_t nlarge; // pooled table entries allocated outside of the blocks
+    struct bth_bloom *bloom; // filters out misses, see bth_htab_bloom
+#ifdef BTH_HTAB_COUNTERS
+    size_t hits; // lookups, puts and deletes included
+    size_t misses;
+    size_t recaps;
+    size_t resizes;
+#endif
 };
 
 // one at a time
 uint32_t oaat(const char *key);
 // daniel j bernstein 2
 uint32_t djb2(const char *key);
+// wang yi's wyhash, 8 bytes at a time
+uint64_t wyhash(const void *key, size_t len, uint64_t seed);
 
-#ifndef BTH_HTAB_HASH
-#define BTH_HTAB_HASH(key) djb2(key)
+// seed of the default hash, set it to a random value before creating any
+// table to make collisions hard to forge
+extern uint64_t bth_htab_seed;
+
+#ifndef BTH_HTAB_SEED
+#define BTH_HTAB_SEED bth_htab_seed
 #endif
 
-#ifndef BTH_HTAB_DATACMP
-#define BTH_HTAB_DATACMP(d1, d2) \
-    ((d1)->hash != (d2)->hash || strcmp((d1)->key, (d2)->key))
+// a BTH_HTAB_HASH override alone would be silently ignored
+#if defined(BTH_HTAB_HASH) && !defined(BTH_HTAB_HASHN)
+#error "define BTH_HTAB_HASHN(key, len), tables do not use BTH_HTAB_HASH"
+#endif
+
+// keys are copied with their length through the table allocator
+#ifdef BTH_HTAB_KEYDUP
+#error "BTH_HTAB_KEYDUP is no longer used, keys are copied through alloc"
+#endif
+
+#ifndef BTH_HTAB_HASHN
+#define BTH_HTAB_HASHN(key, len) wyhash(key, len, BTH_HTAB_SEED)
+#endif
+
+// tables only hash through BTH_HTAB_HASHN, this is a shorthand for
+// NUL terminated keys
+#ifndef BTH_HTAB_HASH
+#define BTH_HTAB_HASH(key) BTH_HTAB_HASHN(key, BTH_HTAB_STRLEN(key))
 #endif
 
-#ifndef BTH_HTAB_KEYDUP
-#define BTH_HTAB_KEYDUP(k) strdup(k)
+#ifndef BTH_HTAB_DATACMP
+#define BTH_HTAB_DATACMP(d1, d2) ((d1)->hash != (d2)->hash \
+    || (d1)->klen != (d2)->klen \
+    || BTH_HTAB_MEMCMP((d1)->key, (d2)->key, (d1)->klen))
 #endif
 
 #ifndef BTH_HTAB_STRLEN
@@ -100,6 +182,11 @@ uint32_t djb2(const char *key);
 #define BTH_HTAB_MEMCPY(dst, src, n) memcpy(dst, src, n)
 #endif
 
+#ifndef BTH_HTAB_MEMCMP
+#include <string.h>
+#define BTH_HTAB_MEMCMP(s1, s2, n) memcmp(s1, s2, n)
+#endif
+
 #ifndef BTH_HTAB_ERRX
 #include <err.h>
 #define BTH_HTAB_ERRX(c, msg, ...) errx(c, msg, __VA_ARGS__)
@@ -112,33 +199,597 @@ uint32_t djb2(const char *key);
 #define BTH_HTAB_FREE(p) free(p)
 #endif
 
+// buckets migrated per operation during an incremental recap
+#ifndef BTH_HTAB_REHASH_STEP
+#define BTH_HTAB_REHASH_STEP 4
+#endif
+
+// entries per bucket triggering growth of incremental tables
+#ifndef BTH_HTAB_MAXLOAD
+#define BTH_HTAB_MAXLOAD 1
+#endif
+
+// keys hashed and prefetched ahead by the *_many functions
+#ifndef BTH_HTAB_BATCH
+#define BTH_HTAB_BATCH 16
+#endif
+
+#ifndef BTH_HTAB_PREFETCH
+#define BTH_HTAB_PREFETCH(p) __builtin_prefetch(p)
+#endif
+
+// bucket lengths counted by bth_htab_stats, the last one counts longer ones
+#ifndef BTH_HTAB_HISTO
+#define BTH_HTAB_HISTO 16
+#endif
+
+// minimal size of pooled tables blocks
+#ifndef BTH_HTAB_BLOCK
+#define BTH_HTAB_BLOCK 16384
+#endif
+
+#define BTH_HTAB__ALLOC(a, n) \
+    ((a) ? (a)->alloc((a)->ctx, n) : BTH_HTAB_ALLOC(n))
+#define BTH_HTAB__REALLOC(a, p, o, n) \
+    ((a) ? (a)->realloc((a)->ctx, p, o, n) : BTH_HTAB_REALLOC(p, n))
+#define BTH_HTAB__FREE(a, p, n) \
+    ((a) ? (a)->free((a)->ctx, p, n) : BTH_HTAB_FREE(p))
+
 struct bth_htab *bth_htab_new(size_t cap, size_t nd, size_t nb);
+// the table and everything it holds is allocated through alloc
+struct bth_htab *bth_htab_new_with(size_t cap, size_t nd, size_t nb,
+    const struct bth_allocator *alloc);
+void bth_htab_free(struct bth_htab *ht);
 
-size_t bth_htab_add(struct bth_htab *ht, const char *k, void *val);
+size_t bth_htab_put(struct bth_htab *ht, const char *k, void *val);
 void *bth_htab_delete(struct bth_htab *ht, const char *key);
 
+// the *n variants take keys of len bytes that need not be NUL terminated
+// (e.g. a token inside a buffer), and only copy them when adding an entry
+//
+// v = bth_htab_vgetn(ht, tok.begin, tok.end - tok.begin);
+
+size_t bth_htab_putn(struct bth_htab *ht, const char *k, size_t len,
+    void *val);
+void *bth_htab_deleten(struct bth_htab *ht, const char *key, size_t len);
+
 // resize bucket list
 void bth_htab_recap(struct bth_htab *ht, size_t newcap);
+// migrate at most n buckets of an ongoing recap, return how many are left
+size_t bth_htab_rehash(struct bth_htab *ht, size_t n);
 // resize data array
 void bth_htab_resize(struct bth_htab *ht, size_t s);
 // reput hdata at idx inside the map (idx MUST be valid)
 void bth_htab_reput(struct bth_htab *ht, size_t idx);
 
 void bth_htab_reset(struct bth_htab *ht);
+// pack live entries at the start of data and shrink it
+// data indices returned so far are invalidated
+void bth_htab_compact(struct bth_htab *ht);
+
+// (re)build a bloom filter sized for n keys (at least the current count) in
+// front of the buckets, most misses then only read one of its cache lines
+// it grows with the table and is rebuilt by compact to forget deleted keys
+void bth_htab_bloom(struct bth_htab *ht, size_t n);
+
+struct bth_htab_stats
+{
+    size_t count;
+    size_t cap;
+    double load; // count / cap
+    size_t histo[BTH_HTAB_HISTO]; // buckets by length, histo[0] are empty
+    size_t maxprobe; // longest bucket, compared entries of the worst miss
+    double meanprobe; // mean compared entries of a hit
+    size_t dfree; // data slots not holding an entry
+    size_t wasted; // idx bytes past the end of buckets
+#ifdef BTH_HTAB_COUNTERS
+    size_t hits;
+    size_t misses;
+    size_t recaps;
+    size_t resizes;
+#endif
+};
+
+// an ongoing incremental recap is finished first
+void bth_htab_stats(struct bth_htab *ht, struct bth_htab_stats *st);
+void bth_htab_stats_dump(struct bth_htab *ht, FILE *f);
 
 struct bth_hdata *bth_htab_get(struct bth_htab *ht, const char *key);
 void *bth_htab_vget(struct bth_htab *ht, const char *key);
+struct bth_hdata *bth_htab_getn(struct bth_htab *ht, const char *key,
+    size_t len);
+void *bth_htab_vgetn(struct bth_htab *ht, const char *key, size_t len);
 
 // return a pointer to data-idx of (key, hash)
 size_t *bth_htab_get_idxp(struct bth_htab *ht, const char *key, uint64_t hash);
+size_t *bth_htab_get_idxpn(struct bth_htab *ht, const char *key, size_t len,
+    uint64_t hash);
+
+// look up or put n keys (lens may be NULL for NUL terminated keys)
+// keys are hashed by batches whose buckets and entries are prefetched before
+// being searched, so that cache misses of different keys overlap
+//
+// get_many stores the entries (NULL if missing) in res and returns how many
+// were found, put_many stores the data indices in res (if not NULL) and
+// returns how many keys were added
+size_t bth_htab_get_many(struct bth_htab *ht, size_t n, const char **keys,
+    const size_t *lens, struct bth_hdata **res);
+size_t bth_htab_put_many(struct bth_htab *ht, size_t n, const char **keys,
+    const size_t *lens, void **vals, size_t *res);
 
 size_t bth_htab__dputd(struct bth_htab *ht, struct bth_hdata *hd);
+// bth_htab_putn with a precomputed hash
+size_t bth_htab__puth(struct bth_htab *ht, const char *k, size_t len,
+    uint64_t hash, void *val);
+// hash keys[0..n] into hashes and prefetch their buckets
+void bth_htab__prefetch(struct bth_htab *ht, size_t n, const char **keys,
+    const size_t *lens, uint64_t *hashes);
+// allocate an entry holding a copy of k, and release it
+struct bth_hdata *bth_htab__dnew(struct bth_htab *ht, const char *k,
+    size_t len);
+void bth_htab__ddel(struct bth_htab *ht, struct bth_hdata *hd);
+// release every entry
+void bth_htab__dclear(struct bth_htab *ht);
+// like bth_htab_get_idxp, *hbp is set to the bucket holding the result
+size_t *bth_htab__find(struct bth_htab *ht, const char *key, size_t len,
+    uint64_t hash, struct bth_hbuck **hbp);
+size_t *bth_htab__scan(struct bth_htab *ht, struct bth_hbuck *hb,
+    struct bth_hdata *hd1);
+void *bth_htab__calloc(const struct bth_allocator *a, size_t n, size_t size);
+char *bth_htab__keydup(const struct bth_allocator *a, const char *k,
+    size_t len);
+
+// open addressing table storing entries inline
+// ctrl holds a 7 bits tag of each slot hash (or EMPTY/DELETED) so that a
+// group of 16 slots is matched at once (SSE2 when available)
+//
+// ctrl  = { 0x80, 0x13, 0xFE, 0x7A, ... }  one byte per slot
+// slots = { -, {hash, key, value}, -, {hash, key, value}, ... }
+
+#define BTH_HFLAT_GROUP 16
+#define BTH_HFLAT_EMPTY 0x80
+#define BTH_HFLAT_DELETED 0xFE
+
+// low bits of the mixed hash select the first group, high bits the tag
+#define BTH_HFLAT_H1(h) (h)
+#define BTH_HFLAT_H2(h) ((uint8_t)((h) >> 57))
+
+struct bth_hflat
+{
+    size_t cap; // slots, power of 2 multiple of BTH_HFLAT_GROUP
+    size_t len; // live entries
+    size_t used; // live and deleted entries
+    uint8_t *ctrl;
+    struct bth_hdata *slots;
+    const struct bth_allocator *alloc; // BTH_HTAB_ALLOC & co if NULL
+};
+
+struct bth_hflat *bth_hflat_new(size_t cap);
+struct bth_hflat *bth_hflat_new_with(size_t cap,
+    const struct bth_allocator *alloc);
+void bth_hflat_free(struct bth_hflat *ft);
+
+// entries pointers are valid until the next put
+// like bth_htab_put, errno is ENOENT if the key was added
+struct bth_hdata *bth_hflat_put(struct bth_hflat *ft, const char *k,
+    void *val);
+void *bth_hflat_delete(struct bth_hflat *ft, const char *key);
+struct bth_hdata *bth_hflat_get(struct bth_hflat *ft, const char *key);
+void *bth_hflat_vget(struct bth_hflat *ft, const char *key);
+
+// like bth_htab_putn & co
+struct bth_hdata *bth_hflat_putn(struct bth_hflat *ft, const char *k,
+    size_t len, void *val);
+void *bth_hflat_deleten(struct bth_hflat *ft, const char *key, size_t len);
+struct bth_hdata *bth_hflat_getn(struct bth_hflat *ft, const char *key,
+    size_t len);
+void *bth_hflat_vgetn(struct bth_hflat *ft, const char *key, size_t len);
+
+// rehash into newcap slots (rounded up), drops deleted entries
+void bth_hflat_recap(struct bth_hflat *ft, size_t newcap);
+
+// spread weak (e.g. 32 bits or sequential) hashes over all bits
+uint64_t bth_hflat__mix(uint64_t h);
+// bitmask of the slots of the group at ctrl holding byte b
+uint32_t bth_hflat__match(const uint8_t *ctrl, uint8_t b);
+struct bth_hdata *bth_hflat__find(struct bth_hflat *ft, const char *key,
+    size_t len, uint64_t hash);
+size_t bth_hflat__slot(struct bth_hflat *ft, uint64_t hash);
+
+// 64x64 -> 128 bits multiplication, lo and hi halves in *a and *b
+void bth_htab__mum(uint64_t *a, uint64_t *b);
+uint64_t bth_htab__wymix(uint64_t a, uint64_t b);
+uint64_t bth_htab__r8(const uint8_t *p);
+uint64_t bth_htab__r4(const uint8_t *p);
+
+// murmur3 finalizer, inlined by the typed maps
+static inline uint64_t bth_htab_mix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33;
+
+    return h;
+}
+
+#define BTH_HTAB_HASH_INT(k) bth_htab_mix64((uint64_t)(k))
+#define BTH_HTAB_HASH_PTR(k) bth_htab_mix64((uint64_t)(uintptr_t)(k))
+#define BTH_HTAB_EQ(a, b) ((a) == (b))
+
+// map of K to V stored inline, hash(k) and eq(a, b) are expanded in place
+// linear probing, deletion shifts the following entries back so there are
+// no tombstones, iteration walks slots in memory order
+//
+// BTH_HTAB_TYPEDEF(Symtab, uint64_t, int, BTH_HTAB_HASH_INT, BTH_HTAB_EQ);
+// Symtab m;
+// Symtab_init(&m, 64);
+// *Symtab_put(&m, 42, 0) += 1;
+// for (size_t i = Symtab_next(&m, 0); i < m.cap; i = Symtab_next(&m, i + 1))
+//     use(m.slots[i].key, m.slots[i].value);
+//
+// value pointers are valid until the next put or delete
+// like bth_htab_put, put keeps the value of a key already there and sets
+// errno to ENOENT if it was added
+
+#define BTH_HTAB_TYPEDEF(name, K, V, hash, eq) \
+typedef struct { K key; V value; } name##_entry; \
+typedef struct \
+{ \
+    size_t cap; /* power of 2 */ \
+    size_t len; \
+    uint8_t *used; \
+    name##_entry *slots; \
+    const struct bth_allocator *alloc; /* BTH_HTAB_ALLOC & co if NULL */ \
+} name; \
+\
+static inline void name##_recap(name *m, size_t cap); \
+\
+static inline void name##_init_with(name *m, size_t cap, \
+    const struct bth_allocator *alloc) \
+{ \
+    m->cap = 0; \
+    m->len = 0; \
+    m->used = NULL; \
+    m->slots = NULL; \
+    m->alloc = alloc; \
+    name##_recap(m, cap); \
+} \
+\
+static inline void name##_init(name *m, size_t cap) \
+{ \
+    name##_init_with(m, cap, NULL); \
+} \
+\
+static inline void name##_free(name *m) \
+{ \
+    BTH_HTAB__FREE(m->alloc, m->used, m->cap); \
+    BTH_HTAB__FREE(m->alloc, m->slots, m->cap * sizeof(name##_entry)); \
+    m->cap = m->len = 0; \
+    m->used = NULL; \
+    m->slots = NULL; \
+} \
+\
+/* slot of key, or the empty one where it would go */ \
+static inline size_t name##__slot(const name *m, K key) \
+{ \
+    size_t mask = m->cap - 1; \
+    size_t i = (hash(key)) & mask; \
+\
+    while (m->used[i] && !(eq(m->slots[i].key, key))) \
+        i = (i + 1) & mask; \
+\
+    return i; \
+} \
+\
+/* at least 4 slots for 3 entries */ \
+static inline void name##_recap(name *m, size_t cap) \
+{ \
+    size_t c = 8; \
+\
+    while (c < cap || c - c / 4 <= m->len) \
+        c *= 2; \
+\
+    name old = *m; \
+\
+    m->cap = c; \
+    m->used = BTH_HTAB__ALLOC(m->alloc, c); \
+    m->slots = BTH_HTAB__ALLOC(m->alloc, c * sizeof(name##_entry)); \
+\
+    if (!m->used || !m->slots) \
+        BTH_HTAB_ERRX(1, "Cannot allocate %zu " #name " slots", c); \
+\
+    BTH_HTAB_MEMSET(m->used, 0, c); \
+\
+    for (size_t i = 0; i < old.cap; i++) \
+    { \
+        if (!old.used[i]) \
+            continue; \
+\
+        size_t s = name##__slot(m, old.slots[i].key); \
+\
+        m->used[s] = 1; \
+        m->slots[s] = old.slots[i]; \
+    } \
+\
+    BTH_HTAB__FREE(m->alloc, old.used, old.cap); \
+    BTH_HTAB__FREE(m->alloc, old.slots, old.cap * sizeof(name##_entry)); \
+} \
+\
+static inline V *name##_get(const name *m, K key) \
+{ \
+    size_t s = name##__slot(m, key); \
+    return m->used[s] ? &m->slots[s].value : NULL; \
+} \
+\
+static inline V *name##_put(name *m, K key, V val) \
+{ \
+    size_t s = name##__slot(m, key); \
+\
+    errno = 0; \
+\
+    if (m->used[s]) \
+        return &m->slots[s].value; \
+\
+    if (m->len + 1 > m->cap - m->cap / 4) \
+    { \
+        name##_recap(m, m->cap * 2); \
+        s = name##__slot(m, key); \
+    } \
+\
+    m->used[s] = 1; \
+    m->slots[s].key = key; \
+    m->slots[s].value = val; \
+    m->len++; \
+\
+    errno = ENOENT; \
+    return &m->slots[s].value; \
+} \
+\
+/* the value is stored in *val if not NULL */ \
+static inline bool name##_delete(name *m, K key, V *val) \
+{ \
+    size_t mask = m->cap - 1; \
+    size_t i = name##__slot(m, key); \
+\
+    if (!m->used[i]) \
+        return false; \
+\
+    if (val) \
+        *val = m->slots[i].value; \
+\
+    /* move back entries whose home slot is not in ]i, j] */ \
+    for (size_t j = (i + 1) & mask; m->used[j]; j = (j + 1) & mask) \
+    { \
+        size_t h = (hash(m->slots[j].key)) & mask; \
+\
+        if (i <= j ? (h <= i || h > j) : (h <= i && h > j)) \
+        { \
+            m->slots[i] = m->slots[j]; \
+            i = j; \
+        } \
+    } \
+\
+    m->used[i] = 0; \
+    m->len--; \
+\
+    return true; \
+} \
+\
+/* first used slot from i on, cap if none */ \
+static inline size_t name##_next(const name *m, size_t i) \
+{ \
+    while (i < m->cap && !m->used[i]) \
+        i++; \
+\
+    return i; \
+}
+
+#ifdef BTH_HTAB_CONCURRENT
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+// table shared between threads, keys are spread over shards by hash bits
+// writers lock the shard of their key, readers take no lock: entries and
+// shard tables are never modified once published, removed ones are only
+// released when no reader can still see them (epoch based reclamation)
+//
+// chtab.shards = {
+//     [0]: { lock, &{ cap, [&entry, NULL, TOMB, &entry, ...] } }
+//     .
+//     .
+//     .
+//     [nshards - 1]: { lock, &{ cap, [...] } }
+// }
+
+#ifndef BTH_CHTAB_CACHELINE
+#define BTH_CHTAB_CACHELINE 64
+#endif
+
+// threads using concurrent tables at the same time
+#ifndef BTH_CHTAB_THREADS
+#define BTH_CHTAB_THREADS 256
+#endif
+
+// objects retired by a shard between two tries to release them
+#ifndef BTH_CHTAB_RECLAIM
+#define BTH_CHTAB_RECLAIM 64
+#endif
+
+enum BTH_CHTAB_STATUS
+{
+    CHT_OK,
+    CHT_ADDED,
+    CHT_NOTFOUND,
+    CHT_NOMEM,
+};
+
+struct bth_centry
+{
+    uint64_t hash;
+    size_t klen;
+    void *value;
+    char key[]; // NUL terminated copy
+};
+
+// linear probing, keeps at least a quarter of its slots NULL
+struct bth_ctab
+{
+    size_t cap; // power of 2
+    _Atomic(struct bth_centry *) slots[];
+};
+
+struct bth_cretired
+{
+    void *ptr;
+    size_t size;
+    uint64_t epoch; // global epoch when it was unlinked
+};
+
+struct bth_cshard
+{
+    _Alignas(BTH_CHTAB_CACHELINE) pthread_mutex_t lock;
+    _Atomic(struct bth_ctab *) tab;
+    size_t len; // live entries
+    size_t used; // live entries and tombstones
+    struct bth_cretired *retired; // oldest first
+    size_t nretired;
+    size_t retcap;
+    size_t retmark; // next reclaim once nretired reaches it
+};
+
+struct bth_chtab
+{
+    size_t nshards; // power of 2
+    struct bth_cshard *shards;
+    void *base; // shards allocation, before alignment
+    const struct bth_allocator *alloc; // MUST be thread safe
+};
+
+// cap is the initial number of slots of each shard
+struct bth_chtab *bth_chtab_new(size_t nshards, size_t cap);
+struct bth_chtab *bth_chtab_new_with(size_t nshards, size_t cap,
+    const struct bth_allocator *alloc);
+// MUST not be in use by any other thread
+void bth_chtab_free(struct bth_chtab *ct);
+
+// CHT_ADDED, or CHT_OK if the key was already there (its value is kept)
+enum BTH_CHTAB_STATUS bth_chtab_put(struct bth_chtab *ct, const char *k,
+    void *val);
+enum BTH_CHTAB_STATUS bth_chtab_putn(struct bth_chtab *ct, const char *k,
+    size_t len, void *val);
+// CHT_OK with the value in *val (if not NULL), or CHT_NOTFOUND
+enum BTH_CHTAB_STATUS bth_chtab_get(struct bth_chtab *ct, const char *k,
+    void **val);
+enum BTH_CHTAB_STATUS bth_chtab_getn(struct bth_chtab *ct, const char *k,
+    size_t len, void **val);
+// like bth_chtab_get, the entry is removed
+enum BTH_CHTAB_STATUS bth_chtab_delete(struct bth_chtab *ct, const char *k,
+    void **val);
+enum BTH_CHTAB_STATUS bth_chtab_deleten(struct bth_chtab *ct, const char *k,
+    size_t len, void **val);
+
+struct bth_cshard *bth_chtab__shard(struct bth_chtab *ct, uint64_t hash);
+// entry of (k, hash) in t, NULL if none
+// *slot is set to its slot, or to the NULL ending its probe sequence, and
+// *tomb to the first tombstone met, if not NULL
+// readers must use the returned entry, the slot may change under them
+struct bth_centry *bth_chtab__probe(struct bth_ctab *t, const char *k,
+    size_t len, uint64_t hash, size_t *slot, size_t *tomb);
+struct bth_ctab *bth_chtab__tnew(const struct bth_allocator *a, size_t cap);
+// rebuild the table of sh without tombstones, large enough for one more entry
+struct bth_ctab *bth_chtab__grow(struct bth_chtab *ct, struct bth_cshard *sh);
+// readers critical section
+void bth_chtab__enter(void);
+void bth_chtab__exit(void);
+// release ptr once no reader can hold it anymore (shard lock held)
+void bth_chtab__retire(struct bth_chtab *ct, struct bth_cshard *sh,
+    void *ptr, size_t size);
+void bth_chtab__reclaim(struct bth_chtab *ct, struct bth_cshard *sh);
+
+#endif
+
+#ifdef BTH_HTAB_SNAPSHOT
+
+// read-only image of a table meant to be mmap'ed and queried in place,
+// every reference is an offset from the start of the file
+//
+// | header | buckets[nbuckets + 1] | entries[nentries] | blob |
+//
+// entries of bucket i are entries[buckets[i]..buckets[i + 1]], keys (NUL
+// terminated) and values lie in blob, hashes are wyhash with header.seed
+// integers are in the host byte order
+
+#define BTH_HSNAP_MAGIC "BTHHSNAP"
+#define BTH_HSNAP_VERSION 1
+
+struct bth_hsnap_hdr
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags; // reserved
+    uint64_t seed;
+    uint64_t nbuckets; // power of 2
+    uint64_t nentries;
+    uint64_t buckets; // offsets
+    uint64_t entries;
+    uint64_t blob;
+    uint64_t size; // whole file
+};
+
+struct bth_hsnap_entry
+{
+    uint64_t hash;
+    uint64_t koff; // from the start of the file
+    uint64_t klen;
+    uint64_t voff;
+    uint64_t vlen;
+};
+
+struct bth_hsnap
+{
+    const uint8_t *base;
+    size_t size;
+    bool mapped; // base was mmap'ed by bth_hsnap_open
+    const struct bth_hsnap_hdr *hdr;
+    const uint64_t *buckets;
+    const struct bth_hsnap_entry *entries;
+};
+
+// bytes stored for value, values are left empty if vbytes is NULL
+// they are written before the next call, so they may live in one buffer
+typedef const void *(*bth_hsnap_vbytes)(void *value, size_t *len);
+
+// 0 on success, -1 and errno set otherwise
+int bth_htab_dump(struct bth_htab *ht, const char *path,
+    bth_hsnap_vbytes vbytes);
+
+// map path, or use the image at mem (which MUST outlive sn)
+// 0 on success, -1 and errno set (EINVAL if the image is malformed)
+// every offset is checked once here, lookups trust them afterwards
+int bth_hsnap_open(struct bth_hsnap *sn, const char *path);
+int bth_hsnap_init(struct bth_hsnap *sn, const void *mem, size_t size);
+void bth_hsnap_close(struct bth_hsnap *sn);
+
+// value of key (*vlen set if not NULL), NULL if missing
+const void *bth_hsnap_get(const struct bth_hsnap *sn, const char *key,
+    size_t *vlen);
+const void *bth_hsnap_getn(const struct bth_hsnap *sn, const char *key,
+    size_t len, size_t *vlen);
+
+#endif
 
 #ifdef BTH_HTAB_IMPLEMENTATION
 
 #include <assert.h>
 #include <errno.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 uint32_t oaat(const char *key)
 {
     size_t i = 0;
@@ -170,63 +821,258 @@ uint32_t djb2(const char *key)
     return hash;
 }
 
+uint64_t bth_htab_seed = 0;
+
+void bth_htab__mum(uint64_t *a, uint64_t *b)
+{
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t)*a * *b;
+
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, la = (uint32_t)*a;
+    uint64_t hb = *b >> 32, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+uint64_t bth_htab__wymix(uint64_t a, uint64_t b)
+{
+    bth_htab__mum(&a, &b);
+    return a ^ b;
+}
+
+// native endian reads, hashes differ between little and big endian hosts
+uint64_t bth_htab__r8(const uint8_t *p)
+{
+    uint64_t v;
+    BTH_HTAB_MEMCPY(&v, p, 8);
+    return v;
+}
+
+uint64_t bth_htab__r4(const uint8_t *p)
+{
+    uint32_t v;
+    BTH_HTAB_MEMCPY(&v, p, 4);
+    return v;
+}
+
+uint64_t wyhash(const void *key, size_t len, uint64_t seed)
+{
+    static const uint64_t s[4] = {
+        0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+        0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull,
+    };
+    const uint8_t *p = key;
+    uint64_t a, b;
+
+    seed ^= bth_htab__wymix(seed ^ s[0], s[1]);
+
+    if (len <= 16)
+    {
+        if (len >= 4)
+        {
+            size_t o = (len >> 3) << 2;
+
+            a = bth_htab__r4(p) << 32 | bth_htab__r4(p + o);
+            b = bth_htab__r4(p + len - 4) << 32
+                | bth_htab__r4(p + len - 4 - o);
+        }
+        else if (len)
+        {
+            a = (uint64_t)p[0] << 16 | (uint64_t)p[len >> 1] << 8
+                | p[len - 1];
+            b = 0;
+        }
+        else
+            a = b = 0;
+    }
+    else
+    {
+        size_t i = len;
+
+        if (i > 48)
+        {
+            uint64_t see1 = seed, see2 = seed;
+
+            do
+            {
+                seed = bth_htab__wymix(bth_htab__r8(p) ^ s[1],
+                    bth_htab__r8(p + 8) ^ seed);
+                see1 = bth_htab__wymix(bth_htab__r8(p + 16) ^ s[2],
+                    bth_htab__r8(p + 24) ^ see1);
+                see2 = bth_htab__wymix(bth_htab__r8(p + 32) ^ s[3],
+                    bth_htab__r8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+
+            seed ^= see1 ^ see2;
+        }
+
+        for (; i > 16; i -= 16, p += 16)
+        {
+            seed = bth_htab__wymix(bth_htab__r8(p) ^ s[1],
+                bth_htab__r8(p + 8) ^ seed);
+        }
+
+        a = bth_htab__r8(p + i - 16);
+        b = bth_htab__r8(p + i - 8);
+    }
+
+    a ^= s[1];
+    b ^= seed;
+    bth_htab__mum(&a, &b);
+
+    return bth_htab__wymix(a ^ s[0] ^ len, b ^ s[1]);
+}
+
+void *bth_htab__calloc(const struct bth_allocator *a, size_t n, size_t size)
+{
+    if (!a)
+        return BTH_HTAB_CALLOC(n, size);
+
+    void *p = BTH_HTAB__ALLOC(a, n * size);
+
+    if (p)
+        BTH_HTAB_MEMSET(p, 0, n * size);
+
+    return p;
+}
+
+char *bth_htab__keydup(const struct bth_allocator *a, const char *k,
+    size_t len)
+{
+    char *key = BTH_HTAB__ALLOC(a, len + 1);
+
+    if (key)
+    {
+        BTH_HTAB_MEMCPY(key, k, len);
+        key[len] = 0;
+    }
+
+    return key;
+}
+
 struct bth_htab *bth_htab_new(size_t cap, size_t nd, size_t nb)
 {
-    struct bth_htab *ht = BTH_HTAB_ALLOC(sizeof(struct bth_htab));
+    return bth_htab_new_with(cap, nd, nb, NULL);
+}
 
-    ht->cap = cap;
-    ht->size = nd;
+struct bth_htab *bth_htab_new_with(size_t cap, size_t nd, size_t nb,
+    const struct bth_allocator *alloc)
+{
+    struct bth_htab *ht = BTH_HTAB__ALLOC(alloc, sizeof(struct bth_htab));
+    struct bth_htab tmp = {.alloc = alloc, .top = 1};
+
+    *ht = tmp;
     ht->nd = nd;
 
+    // data[0] is reserved
     if (!nd)
         nd++;
 
+    ht->cap = cap;
+    ht->size = nd;
     ht->nb = nb;
-    ht->map = BTH_HTAB_ALLOC(cap * sizeof(struct bth_hbuck));
+    ht->map = bth_htab__calloc(ht->alloc, cap, sizeof(struct bth_hbuck));
 
-    for (size_t i = 0; i < cap; i++)
-    {
-        ht->map[i].idx = BTH_HTAB_CALLOC(nb, sizeof(size_t));
-        ht->map[i].cap = nb;
-    }
-
-    ht->data = BTH_HTAB_ALLOC(nd * sizeof(struct bth_hdata *));
+    ht->data = BTH_HTAB__ALLOC(ht->alloc, nd * sizeof(struct bth_hdata *));
     BTH_HTAB_MEMSET(ht->data, 0, nd * sizeof(struct bth_hdata *));
     ht->data[0] = (void *)0xdeadbeef;
 
     return ht;
 }
 
+void bth_htab_free(struct bth_htab *ht)
+{
+    bth_htab_rehash(ht, SIZE_MAX);
+    bth_htab__dclear(ht);
+
+    if (ht->bloom)
+        bth_bloom_free(ht->bloom);
+
+    if (ht->blocks)
+    {
+        BTH_HTAB__FREE(ht->alloc, ht->blocks, ht->blocks->cap);
+    }
+
+    for (size_t i = 0; i < ht->cap; i++)
+    {
+        if (ht->map[i].cap)
+        {
+            BTH_HTAB__FREE(ht->alloc, ht->map[i].idx,
+                ht->map[i].cap * sizeof(size_t));
+        }
+    }
+
+    BTH_HTAB__FREE(ht->alloc, ht->map, ht->cap * sizeof(struct bth_hbuck));
+    BTH_HTAB__FREE(ht->alloc, ht->data,
+        ht->size * sizeof(struct bth_hdata *));
+    BTH_HTAB__FREE(ht->alloc, ht->free, ht->freecap * sizeof(size_t));
+    BTH_HTAB__FREE(ht->alloc, ht, sizeof(struct bth_htab));
+}
+
 size_t bth_htab_put(struct bth_htab *ht, const char *k, void *val)
 {
-    errno = 0;
-    uint64_t hash = BTH_HTAB_HASH(k);
+    return bth_htab_putn(ht, k, BTH_HTAB_STRLEN(k), val);
+}
+
+size_t bth_htab_putn(struct bth_htab *ht, const char *k, size_t len,
+    void *val)
+{
+    return bth_htab__puth(ht, k, len, BTH_HTAB_HASHN(k, len), val);
+}
 
-    size_t *idxp = bth_htab_get_idxp(ht, k, hash);
+size_t bth_htab__puth(struct bth_htab *ht, const char *k, size_t len,
+    uint64_t hash, void *val)
+{
+    errno = 0;
+    size_t *idxp = bth_htab__find(ht, k, len, hash, NULL);
 
     if (errno != ENOENT)
         return *idxp;
 
-    char *key = BTH_HTAB_KEYDUP(k);
-    struct bth_hdata *hd = BTH_HTAB_ALLOC(sizeof(struct bth_hdata));
+    struct bth_hdata *hd = bth_htab__dnew(ht, k, len);
 
-    if (errno == ENOMEM)
+    if (!hd)
+    {
+        errno = ENOMEM;
         return 0;
+    }
 
     hd->hash = hash;
-    hd->key = key;
     hd->value = val;
 
     size_t idx = bth_htab__dputd(ht, hd);
 
-    if (errno == ENOMEM)
+    if (!idx)
     {
-        BTH_HTAB_FREE(key);
-        BTH_HTAB_FREE(hd);
+        bth_htab__ddel(ht, hd);
         return 0;
     }
     
     bth_htab_reput(ht, idx);
+    ht->count++;
+
+    if (ht->bloom && ht->count > ht->bloom->n)
+        bth_htab_bloom(ht, ht->count * 2);
+    else if (ht->bloom)
+        bth_bloom_add(ht->bloom, hash);
+
+    if (ht->incremental && !ht->omap
+        && ht->count > ht->cap * BTH_HTAB_MAXLOAD)
+    {
+        bth_htab_recap(ht, ht->cap * 2);
+    }
 
     errno = ENOENT;
     return idx;
@@ -234,16 +1080,32 @@ size_t bth_htab_put(struct bth_htab *ht, const char *k, void *val)
 
 void *bth_htab_delete(struct bth_htab *ht, const char *key)
 {
-    size_t *idxp = bth_htab_get_idxp(ht, key, BTH_HTAB_HASH(key));
+    return bth_htab_deleten(ht, key, BTH_HTAB_STRLEN(key));
+}
+
+void *bth_htab_deleten(struct bth_htab *ht, const char *key, size_t len)
+{
+    struct bth_hbuck *hb;
+    size_t *idxp = bth_htab__find(ht, key, len, BTH_HTAB_HASHN(key, len), &hb);
 
     if (errno == ENOENT)
         return NULL;
 
     struct bth_hdata *d = ht->data[*idxp];
 
+    if (ht->nfree == ht->freecap)
+    {
+        size_t n = ht->freecap ? ht->freecap * 2 : 16;
+
+        ht->free = BTH_HTAB__REALLOC(ht->alloc, ht->free,
+            ht->freecap * sizeof(size_t), n * sizeof(size_t));
+        ht->freecap = n;
+    }
+
+    ht->free[ht->nfree++] = *idxp;
     ht->data[*idxp] = NULL;
+    ht->count--;
 
-    struct bth_hbuck *hb = ht->map + d->hash % ht->cap;
     size_t *last = hb->idx + hb->cap - 1;
     
     if (idxp < last)
@@ -254,47 +1116,85 @@ void *bth_htab_delete(struct bth_htab *ht, const char *key)
 
     void *res = d->value;
 
-    BTH_HTAB_FREE((char *)d->key);
-    BTH_HTAB_FREE(d);
+    bth_htab__ddel(ht, d);
 
     return res;
 }
 
+// the old map is kept until all its buckets were moved to the new one,
+// lookups search both
+// the new map is a single zeroed allocation, bucket indices come with puts
 void bth_htab_recap(struct bth_htab *ht, size_t newcap)
 {
-    for (size_t i = 0; i < ht->cap; i++)
-        BTH_HTAB_FREE(ht->map[i].idx);
+    bth_htab_rehash(ht, SIZE_MAX);
+
+#ifdef BTH_HTAB_COUNTERS
+    ht->recaps++;
+#endif
+
+    ht->omap = ht->map;
+    ht->ocap = ht->cap;
+    ht->rpos = 0;
 
-    ht->map = BTH_HTAB_REALLOC(ht->map, newcap * sizeof(struct bth_hbuck));
+    ht->map = bth_htab__calloc(ht->alloc, newcap, sizeof(struct bth_hbuck));
     ht->cap = newcap;
 
-    for (size_t i = 0; i < ht->cap; i++)
-    {
-        ht->map[i].idx = BTH_HTAB_CALLOC(ht->nb, sizeof(size_t));
-        ht->map[i].cap = ht->nb;
-    }
+    if (!ht->incremental)
+        bth_htab_rehash(ht, SIZE_MAX);
+}
+
+size_t bth_htab_rehash(struct bth_htab *ht, size_t n)
+{
+    if (!ht->omap)
+        return 0;
 
-    for (size_t i = 1; i < ht->size; i++)
+    for (; n && ht->rpos < ht->ocap; n--, ht->rpos++)
     {
-        if (!ht->data[i])
+        struct bth_hbuck *hb = ht->omap + ht->rpos;
+
+        if (!hb->cap)
             continue;
 
-        bth_htab_reput(ht, i);
+        for (size_t i = 0; i < hb->cap && hb->idx[i]; i++)
+            bth_htab_reput(ht, hb->idx[i]);
+
+        BTH_HTAB__FREE(ht->alloc, hb->idx, hb->cap * sizeof(size_t));
     }
+
+    if (ht->rpos < ht->ocap)
+        return ht->ocap - ht->rpos;
+
+    BTH_HTAB__FREE(ht->alloc, ht->omap, ht->ocap * sizeof(struct bth_hbuck));
+    ht->omap = NULL;
+    ht->ocap = 0;
+    ht->rpos = 0;
+
+    return 0;
 }
 
 void bth_htab_resize(struct bth_htab *ht, size_t s)
 {
-    ht->data = BTH_HTAB_REALLOC(ht->data, s * sizeof(struct bth_hdata *));
+#ifdef BTH_HTAB_COUNTERS
+    ht->resizes++;
+#endif
 
-    if (errno == ENOMEM)
+    struct bth_hdata **data = BTH_HTAB__REALLOC(ht->alloc, ht->data,
+        ht->size * sizeof(struct bth_hdata *),
+        s * sizeof(struct bth_hdata *));
+
+    // errno alone is not reliable, malloc may set it and still succeed
+    if (!data)
+    {
+        errno = ENOMEM;
         return;
+    }
 
+    ht->data = data;
     size_t old = ht->size;
     ht->size = s;
 
     if (s > old)
-        BTH_HTAB_MEMSET(ht->data + old, 0, (s - old - 1)
+        BTH_HTAB_MEMSET(ht->data + old, 0, (s - old)
             * sizeof(struct bth_hdata *));
 }
 
@@ -303,18 +1203,22 @@ void bth_htab_reput(struct bth_htab *ht, size_t idx)
     struct bth_hdata *hd = ht->data[idx];
 
     struct bth_hbuck *hb = ht->map + (hd->hash % ht->cap);
-    size_t *last = hb->idx + hb->cap - 1;
+    size_t *last = hb->cap ? hb->idx + hb->cap - 1 : NULL;
 
-    if (*last) // resize bucket idx
+    if (!last || *last) // resize bucket idx
     {
-        size_t inc = ht->nb ? ht->nb : hb->cap;
-        
-        hb->idx =
-            BTH_HTAB_REALLOC(hb->idx, (hb->cap + inc) * sizeof(size_t));
+        size_t inc = ht->nb ? ht->nb : (hb->cap ? hb->cap : 1);
 
-        if (errno == ENOMEM)
+        size_t *idxs = BTH_HTAB__REALLOC(ht->alloc, hb->idx,
+            hb->cap * sizeof(size_t), (hb->cap + inc) * sizeof(size_t));
+
+        if (!idxs)
+        {
+            errno = ENOMEM;
             return;
+        }
 
+        hb->idx = idxs;
         last = hb->idx + hb->cap;
         BTH_HTAB_MEMSET(last, 0, inc * sizeof(size_t));
         hb->cap += inc;
@@ -331,82 +1235,1437 @@ void bth_htab_reput(struct bth_htab *ht, size_t idx)
 void bth_htab_reset(struct bth_htab *ht)
 {
     size_t newds = ht->nd ? ht->nd : 1;
-    size_t newbs = ht->nb ? ht->nb : 0;
+
+    bth_htab_rehash(ht, SIZE_MAX);
+    bth_htab__dclear(ht);
+
+    if (ht->bloom)
+        bth_bloom_clear(ht->bloom);
 
     for (size_t i = 0; i < ht->cap; i++)
     {
         struct bth_hbuck *hb = ht->map + i;
-        hb->idx = BTH_HTAB_REALLOC(hb->idx, newbs);
-        hb->cap = newbs;
+
+        if (hb->cap)
+            BTH_HTAB__FREE(ht->alloc, hb->idx, hb->cap * sizeof(size_t));
+
+        hb->idx = NULL;
+        hb->cap = 0;
     }
 
-    ht->data = BTH_HTAB_REALLOC(ht->data, newds);
+    ht->data = BTH_HTAB__REALLOC(ht->alloc, ht->data,
+        ht->size * sizeof(struct bth_hdata *),
+        newds * sizeof(struct bth_hdata *));
+    ht->size = newds;
     BTH_HTAB_MEMSET(ht->data + 1, 0, (newds - 1) * sizeof(struct bth_hdata *));
+
+    ht->top = 1;
+    ht->nfree = 0;
+    ht->count = 0;
 }
 
-struct bth_hdata *bth_htab_get(struct bth_htab *ht, const char *key)
+void bth_htab_compact(struct bth_htab *ht)
 {
-    size_t *idxp = bth_htab_get_idxp(ht, key, BTH_HTAB_HASH(key));
-    return ht->data[*idxp];
-}
+    size_t top = 1;
+
+    bth_htab_rehash(ht, SIZE_MAX);
+
+    for (size_t i = 1; i < ht->top; i++)
+    {
+        if (ht->data[i])
+            ht->data[top++] = ht->data[i];
+    }
+
+    BTH_HTAB_MEMSET(ht->data + top, 0,
+        (ht->top - top) * sizeof(struct bth_hdata *));
+
+    ht->top = top;
+    ht->nfree = 0;
+
+    for (size_t i = 0; i < ht->cap; i++)
+    {
+        struct bth_hbuck *hb = ht->map + i;
+
+        if (hb->cap)
+            BTH_HTAB_MEMSET(hb->idx, 0, hb->cap * sizeof(size_t));
+    }
+
+    for (size_t i = 1; i < top; i++)
+        bth_htab_reput(ht, i);
+
+    size_t s = top + ht->nd;
+
+    if (s < ht->size)
+        bth_htab_resize(ht, s);
+
+    if (ht->bloom)
+        bth_htab_bloom(ht, ht->bloom->n);
+}
+
+void bth_htab_bloom(struct bth_htab *ht, size_t n)
+{
+    if (ht->bloom)
+        bth_bloom_free(ht->bloom);
+
+    n = n > ht->count ? n : ht->count;
+    ht->bloom = bth_bloom_new_with(n, ht->alloc);
+
+    if (!ht->bloom)
+        BTH_HTAB_ERRX(1, "Cannot allocate bloom filter for %zu keys", n);
+
+    for (size_t i = 1; i < ht->top; i++)
+    {
+        if (ht->data[i])
+            bth_bloom_add(ht->bloom, ht->data[i]->hash);
+    }
+}
+
+void bth_htab_stats(struct bth_htab *ht, struct bth_htab_stats *st)
+{
+    struct bth_htab_stats tmp = {.count = ht->count, .cap = ht->cap};
+    size_t probes = 0;
+
+    bth_htab_rehash(ht, SIZE_MAX);
+
+    for (size_t i = 0; i < ht->cap; i++)
+    {
+        struct bth_hbuck *hb = ht->map + i;
+        size_t len = 0;
+
+        while (len < hb->cap && hb->idx[len])
+            len++;
+
+        tmp.histo[len < BTH_HTAB_HISTO ? len : BTH_HTAB_HISTO - 1]++;
+        tmp.wasted += (hb->cap - len) * sizeof(size_t);
+        probes += len * (len + 1) / 2;
+
+        if (len > tmp.maxprobe)
+            tmp.maxprobe = len;
+    }
+
+    tmp.load = ht->cap ? (double)ht->count / ht->cap : 0;
+    tmp.meanprobe = ht->count ? (double)probes / ht->count : 0;
+    tmp.dfree = ht->size - 1 - ht->count;
+
+#ifdef BTH_HTAB_COUNTERS
+    tmp.hits = ht->hits;
+    tmp.misses = ht->misses;
+    tmp.recaps = ht->recaps;
+    tmp.resizes = ht->resizes;
+#endif
+
+    *st = tmp;
+}
+
+void bth_htab_stats_dump(struct bth_htab *ht, FILE *f)
+{
+    struct bth_htab_stats st;
+
+    bth_htab_stats(ht, &st);
+
+    fprintf(f, "entries %zu, buckets %zu, load %.2f\n",
+        st.count, st.cap, st.load);
+    fprintf(f, "probes max %zu, mean hit %.2f\n", st.maxprobe, st.meanprobe);
+    fprintf(f, "free data slots %zu, wasted idx bytes %zu\n",
+        st.dfree, st.wasted);
+
+#ifdef BTH_HTAB_COUNTERS
+    fprintf(f, "hits %zu, misses %zu, recaps %zu, resizes %zu\n",
+        st.hits, st.misses, st.recaps, st.resizes);
+#endif
+
+    fprintf(f, "\n%8s %12s\n", "length", "buckets");
+
+    for (size_t i = 0; i < BTH_HTAB_HISTO; i++)
+    {
+        if (!st.histo[i])
+            continue;
+
+        fprintf(f, "%7zu%c %12zu\n", i, i == BTH_HTAB_HISTO - 1 ? '+' : ' ',
+            st.histo[i]);
+    }
+}
+
+struct bth_hdata *bth_htab_get(struct bth_htab *ht, const char *key)
+{
+    return bth_htab_getn(ht, key, BTH_HTAB_STRLEN(key));
+}
 
 void *bth_htab_vget(struct bth_htab *ht, const char *key)
 {
-    size_t *idxp = bth_htab_get_idxp(ht, key, BTH_HTAB_HASH(key));
+    return bth_htab_vgetn(ht, key, BTH_HTAB_STRLEN(key));
+}
+
+struct bth_hdata *bth_htab_getn(struct bth_htab *ht, const char *key,
+    size_t len)
+{
+    size_t *idxp = bth_htab__find(ht, key, len, BTH_HTAB_HASHN(key, len),
+        NULL);
 
     if (!idxp)
         return NULL;
 
-    return ht->data[*idxp]->value;
+    return ht->data[*idxp];
+}
+
+void *bth_htab_vgetn(struct bth_htab *ht, const char *key, size_t len)
+{
+    struct bth_hdata *hd = bth_htab_getn(ht, key, len);
+    return hd ? hd->value : NULL;
 }
 
 size_t *bth_htab_get_idxp(struct bth_htab *ht, const char *key, uint64_t hash)
 {
-    struct bth_hbuck *hb = ht->map + hash % ht->cap;
-    struct bth_hdata hd1 = {.hash = hash, .key = key};
+    return bth_htab__find(ht, key, BTH_HTAB_STRLEN(key), hash, NULL);
+}
 
-    errno = 0;
-    
+size_t *bth_htab_get_idxpn(struct bth_htab *ht, const char *key, size_t len,
+    uint64_t hash)
+{
+    return bth_htab__find(ht, key, len, hash, NULL);
+}
+
+// prefetching is done in stages so that each one reads lines requested by
+// the previous one: bucket, bucket indices, data slot, then first entry
+void bth_htab__prefetch(struct bth_htab *ht, size_t n, const char **keys,
+    const size_t *lens, uint64_t *hashes)
+{
+    struct bth_hbuck *hbs[BTH_HTAB_BATCH];
+
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t len = lens ? lens[i] : BTH_HTAB_STRLEN(keys[i]);
+
+        hashes[i] = BTH_HTAB_HASHN(keys[i], len);
+        hbs[i] = ht->map + hashes[i] % ht->cap;
+        BTH_HTAB_PREFETCH(hbs[i]);
+    }
+
+    for (size_t i = 0; i < n; i++)
+        BTH_HTAB_PREFETCH(hbs[i]->idx);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (hbs[i]->cap && hbs[i]->idx[0])
+            BTH_HTAB_PREFETCH(ht->data + hbs[i]->idx[0]);
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (hbs[i]->cap && hbs[i]->idx[0])
+            BTH_HTAB_PREFETCH(ht->data[hbs[i]->idx[0]]);
+    }
+}
+
+size_t bth_htab_get_many(struct bth_htab *ht, size_t n, const char **keys,
+    const size_t *lens, struct bth_hdata **res)
+{
+    uint64_t hashes[BTH_HTAB_BATCH];
+    size_t found = 0;
+
+    for (size_t b = 0; b < n; b += BTH_HTAB_BATCH)
+    {
+        size_t m = n - b < BTH_HTAB_BATCH ? n - b : BTH_HTAB_BATCH;
+        const size_t *l = lens ? lens + b : NULL;
+
+        bth_htab__prefetch(ht, m, keys + b, l, hashes);
+
+        for (size_t i = 0; i < m; i++)
+        {
+            const char *key = keys[b + i];
+            size_t len = l ? l[i] : BTH_HTAB_STRLEN(key);
+            size_t *idxp = bth_htab__find(ht, key, len, hashes[i], NULL);
+
+            res[b + i] = idxp ? ht->data[*idxp] : NULL;
+            found += idxp != NULL;
+        }
+    }
+
+    return found;
+}
+
+size_t bth_htab_put_many(struct bth_htab *ht, size_t n, const char **keys,
+    const size_t *lens, void **vals, size_t *res)
+{
+    uint64_t hashes[BTH_HTAB_BATCH];
+    size_t added = 0;
+
+    for (size_t b = 0; b < n; b += BTH_HTAB_BATCH)
+    {
+        size_t m = n - b < BTH_HTAB_BATCH ? n - b : BTH_HTAB_BATCH;
+        const size_t *l = lens ? lens + b : NULL;
+
+        bth_htab__prefetch(ht, m, keys + b, l, hashes);
+
+        for (size_t i = 0; i < m; i++)
+        {
+            const char *key = keys[b + i];
+            size_t len = l ? l[i] : BTH_HTAB_STRLEN(key);
+            size_t idx = bth_htab__puth(ht, key, len, hashes[i],
+                vals[b + i]);
+
+            if (res)
+                res[b + i] = idx;
+
+            added += errno == ENOENT;
+        }
+    }
+
+    return added;
+}
+
+size_t *bth_htab__scan(struct bth_htab *ht, struct bth_hbuck *hb,
+    struct bth_hdata *hd1)
+{
     for (size_t i = 0; i < hb->cap; i++)
     {
         if (!hb->idx[i])
             break;
-        
+
         size_t *midx = hb->idx + i;
         struct bth_hdata *hd2 = ht->data[*midx];
 
-        if (!BTH_HTAB_DATACMP(hd2, &hd1))
+        if (!BTH_HTAB_DATACMP(hd2, hd1))
             return midx;
     }
 
-    errno = ENOENT;
     return NULL;
 }
 
+size_t *bth_htab__find(struct bth_htab *ht, const char *key, size_t len,
+    uint64_t hash, struct bth_hbuck **hbp)
+{
+    if (ht->omap)
+        bth_htab_rehash(ht, BTH_HTAB_REHASH_STEP);
+
+    struct bth_hbuck *hb = ht->map + hash % ht->cap;
+    struct bth_hdata hd1 = {.hash = hash, .key = key, .klen = len};
+    bool maybe = !ht->bloom || bth_bloom_test(ht->bloom, hash);
+    size_t *idxp = maybe ? bth_htab__scan(ht, hb, &hd1) : NULL;
+
+    // not migrated yet
+    if (maybe && !idxp && ht->omap && hash % ht->ocap >= ht->rpos)
+    {
+        hb = ht->omap + hash % ht->ocap;
+        idxp = bth_htab__scan(ht, hb, &hd1);
+    }
+
+    if (hbp)
+        *hbp = hb;
+
+#ifdef BTH_HTAB_COUNTERS
+    if (idxp)
+        ht->hits++;
+    else
+        ht->misses++;
+#endif
+
+    errno = idxp ? 0 : ENOENT;
+    return idxp;
+}
+
+#define BTH_HTAB__ALIGN(n) \
+    (((n) + _Alignof(struct bth_hdata) - 1) & ~(_Alignof(struct bth_hdata) - 1))
+
+struct bth_hdata *bth_htab__dnew(struct bth_htab *ht, const char *k,
+    size_t len)
+{
+    struct bth_hdata *hd;
+    size_t c = BTH_HTAB__CLASS(len);
+
+    if (!ht->pooled || c >= BTH_HTAB_CLASSES)
+    {
+        hd = BTH_HTAB__ALLOC(ht->alloc, sizeof(struct bth_hdata));
+
+        if (!hd)
+            return NULL;
+
+        hd->key = bth_htab__keydup(ht->alloc, k, len);
+
+        if (!hd->key)
+        {
+            BTH_HTAB__FREE(ht->alloc, hd, sizeof(struct bth_hdata));
+            return NULL;
+        }
+
+        hd->klen = len;
+        ht->nlarge += ht->pooled;
+        return hd;
+    }
+
+    size_t hs = BTH_HTAB__ALIGN(sizeof(struct bth_hblock));
+    size_t es = sizeof(struct bth_hdata) + (c + 1) * 16;
+    struct bth_hblock *b = ht->blocks;
+
+    if ((hd = ht->pfree[c]))
+        ht->pfree[c] = hd->value;
+    else
+    {
+        if (!b || b->len + es > b->cap)
+        {
+            size_t cap = hs + es > BTH_HTAB_BLOCK ? hs + es : BTH_HTAB_BLOCK;
+
+            b = BTH_HTAB__ALLOC(ht->alloc, cap);
+
+            if (!b)
+                return NULL;
+
+            b->prev = ht->blocks;
+            b->cap = cap;
+            b->len = hs;
+            ht->blocks = b;
+        }
+
+        hd = (struct bth_hdata *)((char *)b + b->len);
+        b->len += es;
+    }
+
+    char *key = (char *)(hd + 1);
+
+    BTH_HTAB_MEMCPY(key, k, len);
+    key[len] = 0;
+    hd->key = key;
+    hd->klen = len;
+
+    return hd;
+}
+
+void bth_htab__ddel(struct bth_htab *ht, struct bth_hdata *hd)
+{
+    size_t c = BTH_HTAB__CLASS(hd->klen);
+
+    if (ht->pooled && c < BTH_HTAB_CLASSES)
+    {
+        hd->value = ht->pfree[c];
+        ht->pfree[c] = hd;
+        return;
+    }
+
+    ht->nlarge -= ht->pooled;
+    BTH_HTAB__FREE(ht->alloc, (char *)hd->key, hd->klen + 1);
+    BTH_HTAB__FREE(ht->alloc, hd, sizeof(struct bth_hdata));
+}
+
+// blocks of pooled tables but the last one are released at once, which is
+// then reused from scratch, only entries allocated on their own are released
+// one by one
+void bth_htab__dclear(struct bth_htab *ht)
+{
+    if (!ht->pooled || ht->nlarge)
+    {
+        for (size_t i = 1; i < ht->top; i++)
+        {
+            struct bth_hdata *hd = ht->data[i];
+
+            if (hd && (!ht->pooled
+                || BTH_HTAB__CLASS(hd->klen) >= BTH_HTAB_CLASSES))
+            {
+                bth_htab__ddel(ht, hd);
+            }
+        }
+    }
+
+    struct bth_hblock *b = ht->blocks;
+
+    if (!ht->pooled || !b)
+        return;
+
+    while (b->prev)
+    {
+        struct bth_hblock *prev = b->prev->prev;
+
+        BTH_HTAB__FREE(ht->alloc, b->prev, b->prev->cap);
+        b->prev = prev;
+    }
+
+    b->len = BTH_HTAB__ALIGN(sizeof(struct bth_hblock));
+
+    for (size_t c = 0; c < BTH_HTAB_CLASSES; c++)
+        ht->pfree[c] = NULL;
+}
+
 size_t bth_htab__dputd(struct bth_htab *ht, struct bth_hdata *hd)
 {
-    struct bth_hdata **data = ht->data + 1;
+    size_t idx;
+
+    if (ht->nfree)
+        idx = ht->free[--ht->nfree];
+    else
+    {
+        if (ht->top >= ht->size)
+        {
+            if (ht->noresize)
+            {
+                errno = ENOMEM;
+                return 0;
+            }
+
+            size_t inc = ht->nd ? ht->nd : ht->size;
+            bth_htab_resize(ht, ht->size + inc);
+
+            if (ht->top >= ht->size)
+                return 0;
+        }
+
+        idx = ht->top++;
+    }
+
+    ht->data[idx] = hd;
+    return idx;
+}
+
+struct bth_hflat *bth_hflat_new(size_t cap)
+{
+    return bth_hflat_new_with(cap, NULL);
+}
+
+struct bth_hflat *bth_hflat_new_with(size_t cap,
+    const struct bth_allocator *alloc)
+{
+    struct bth_hflat *ft = BTH_HTAB__ALLOC(alloc, sizeof(struct bth_hflat));
+    struct bth_hflat tmp = {.alloc = alloc};
+
+    *ft = tmp;
+    bth_hflat_recap(ft, cap);
+
+    return ft;
+}
+
+void bth_hflat_free(struct bth_hflat *ft)
+{
+    for (size_t i = 0; i < ft->cap; i++)
+    {
+        if (ft->ctrl[i] & 0x80)
+            continue;
+
+        struct bth_hdata *hd = ft->slots + i;
+        BTH_HTAB__FREE(ft->alloc, (char *)hd->key, hd->klen + 1);
+    }
+
+    BTH_HTAB__FREE(ft->alloc, ft->ctrl, ft->cap);
+    BTH_HTAB__FREE(ft->alloc, ft->slots,
+        ft->cap * sizeof(struct bth_hdata));
+    BTH_HTAB__FREE(ft->alloc, ft, sizeof(struct bth_hflat));
+}
+
+// murmur3 finalizer
+uint64_t bth_hflat__mix(uint64_t h)
+{
+    return bth_htab_mix64(h);
+}
+
+uint32_t bth_hflat__match(const uint8_t *ctrl, uint8_t b)
+{
+#ifdef __SSE2__
+    __m128i g = _mm_loadu_si128((const __m128i *)ctrl);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)b)));
+#else
+    uint32_t m = 0;
+
+    for (int i = 0; i < BTH_HFLAT_GROUP; i++)
+        m |= (uint32_t)(ctrl[i] == b) << i;
 
-    while (data - ht->data < ht->size && *data)
-        data++;
+    return m;
+#endif
+}
 
-    if (data - ht->data >= ht->size)
+struct bth_hdata *bth_hflat__find(struct bth_hflat *ft, const char *key,
+    size_t len, uint64_t hash)
+{
+    uint64_t mixed = bth_hflat__mix(hash);
+    size_t mask = ft->cap / BTH_HFLAT_GROUP - 1;
+    size_t g = BTH_HFLAT_H1(mixed) & mask;
+    uint8_t tag = BTH_HFLAT_H2(mixed);
+    struct bth_hdata hd1 = {.hash = hash, .key = key, .klen = len};
+
+    // triangular probing visits every group
+    for (size_t i = 1; i <= mask + 1; i++)
     {
-        if (ht->noresize)
+        const uint8_t *ctrl = ft->ctrl + g * BTH_HFLAT_GROUP;
+        uint32_t m = bth_hflat__match(ctrl, tag);
+
+        while (m)
         {
-            errno = ENOMEM;
-            return 0;
+            size_t s = g * BTH_HFLAT_GROUP + __builtin_ctz(m);
+
+            if (!BTH_HTAB_DATACMP(ft->slots + s, &hd1))
+                return ft->slots + s;
+
+            m &= m - 1;
         }
 
-        size_t inc = ht->nd ? ht->nd : ht->size;
-        bth_htab_resize(ht, ht->size + inc);
-        data = ht->data + ht->size - inc;
+        if (bth_hflat__match(ctrl, BTH_HFLAT_EMPTY))
+            break;
+
+        g = (g + i) & mask;
+    }
+
+    return NULL;
+}
+
+// first empty or deleted slot for hash
+size_t bth_hflat__slot(struct bth_hflat *ft, uint64_t hash)
+{
+    size_t mask = ft->cap / BTH_HFLAT_GROUP - 1;
+    size_t g = BTH_HFLAT_H1(bth_hflat__mix(hash)) & mask;
+
+    for (size_t i = 1; ; i++)
+    {
+        const uint8_t *ctrl = ft->ctrl + g * BTH_HFLAT_GROUP;
+        uint32_t m = bth_hflat__match(ctrl, BTH_HFLAT_EMPTY)
+            | bth_hflat__match(ctrl, BTH_HFLAT_DELETED);
+
+        if (m)
+            return g * BTH_HFLAT_GROUP + __builtin_ctz(m);
+
+        g = (g + i) & mask;
+    }
+}
+
+void bth_hflat_recap(struct bth_hflat *ft, size_t newcap)
+{
+    size_t cap = BTH_HFLAT_GROUP;
+
+    // keep the load under 7/8
+    while (cap < newcap || cap - cap / 8 <= ft->len)
+        cap *= 2;
+
+    size_t oldcap = ft->cap;
+    uint8_t *oldctrl = ft->ctrl;
+    struct bth_hdata *oldslots = ft->slots;
+
+    ft->ctrl = BTH_HTAB__ALLOC(ft->alloc, cap);
+    ft->slots = BTH_HTAB__ALLOC(ft->alloc, cap * sizeof(struct bth_hdata));
+
+    if (!ft->ctrl || !ft->slots)
+        BTH_HTAB_ERRX(1, "Cannot allocate %zu flat slots", cap);
+
+    BTH_HTAB_MEMSET(ft->ctrl, BTH_HFLAT_EMPTY, cap);
+    ft->cap = cap;
+    ft->used = ft->len;
+
+    for (size_t i = 0; i < oldcap; i++)
+    {
+        if (oldctrl[i] & 0x80)
+            continue;
+
+        size_t s = bth_hflat__slot(ft, oldslots[i].hash);
+
+        ft->ctrl[s] = oldctrl[i];
+        ft->slots[s] = oldslots[i];
     }
 
-    *data = hd;
-    return data - ht->data;
+    BTH_HTAB__FREE(ft->alloc, oldctrl, oldcap);
+    BTH_HTAB__FREE(ft->alloc, oldslots, oldcap * sizeof(struct bth_hdata));
+}
+
+struct bth_hdata *bth_hflat_put(struct bth_hflat *ft, const char *k,
+    void *val)
+{
+    return bth_hflat_putn(ft, k, BTH_HTAB_STRLEN(k), val);
 }
 
+struct bth_hdata *bth_hflat_putn(struct bth_hflat *ft, const char *k,
+    size_t len, void *val)
+{
+    errno = 0;
+    uint64_t hash = BTH_HTAB_HASHN(k, len);
+    struct bth_hdata *hd = bth_hflat__find(ft, k, len, hash);
+
+    if (hd)
+        return hd;
+
+    // grow, or only drop deleted entries if they take most of the room
+    if (ft->used + 1 > ft->cap - ft->cap / 8)
+        bth_hflat_recap(ft, ft->len * 2 > ft->cap ? ft->cap * 2 : ft->cap);
+
+    char *key = bth_htab__keydup(ft->alloc, k, len);
+
+    if (!key)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    size_t s = bth_hflat__slot(ft, hash);
+
+    if (ft->ctrl[s] == BTH_HFLAT_EMPTY)
+        ft->used++;
+
+    ft->len++;
+    ft->ctrl[s] = BTH_HFLAT_H2(bth_hflat__mix(hash));
+
+    hd = ft->slots + s;
+    hd->hash = hash;
+    hd->key = key;
+    hd->klen = len;
+    hd->value = val;
+
+    errno = ENOENT;
+    return hd;
+}
+
+void *bth_hflat_delete(struct bth_hflat *ft, const char *key)
+{
+    return bth_hflat_deleten(ft, key, BTH_HTAB_STRLEN(key));
+}
+
+void *bth_hflat_deleten(struct bth_hflat *ft, const char *key, size_t len)
+{
+    struct bth_hdata *hd = bth_hflat__find(ft, key, len,
+        BTH_HTAB_HASHN(key, len));
+
+    if (!hd)
+    {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    void *res = hd->value;
+
+    BTH_HTAB__FREE(ft->alloc, (char *)hd->key, hd->klen + 1);
+    ft->ctrl[hd - ft->slots] = BTH_HFLAT_DELETED;
+    ft->len--;
+
+    return res;
+}
+
+struct bth_hdata *bth_hflat_get(struct bth_hflat *ft, const char *key)
+{
+    return bth_hflat_getn(ft, key, BTH_HTAB_STRLEN(key));
+}
+
+void *bth_hflat_vget(struct bth_hflat *ft, const char *key)
+{
+    return bth_hflat_vgetn(ft, key, BTH_HTAB_STRLEN(key));
+}
+
+struct bth_hdata *bth_hflat_getn(struct bth_hflat *ft, const char *key,
+    size_t len)
+{
+    struct bth_hdata *hd = bth_hflat__find(ft, key, len,
+        BTH_HTAB_HASHN(key, len));
+
+    errno = hd ? 0 : ENOENT;
+    return hd;
+}
+
+void *bth_hflat_vgetn(struct bth_hflat *ft, const char *key, size_t len)
+{
+    struct bth_hdata *hd = bth_hflat_getn(ft, key, len);
+    return hd ? hd->value : NULL;
+}
+
+#ifdef BTH_HTAB_CONCURRENT
+
+// a thread is in a critical section if its epoch is not 0, the global epoch
+// only moves on once every thread in one has seen its current value
+// so objects retired during epoch e are unreachable from epoch e + 2
+struct bth_cepoch
+{
+    _Alignas(BTH_CHTAB_CACHELINE) _Atomic uint64_t epoch;
+    atomic_bool used;
+};
+
+static struct bth_cepoch bth_chtab__epochs[BTH_CHTAB_THREADS];
+static _Atomic uint64_t bth_chtab__epoch = 1;
+static _Thread_local struct bth_cepoch *bth_chtab__self;
+static pthread_key_t bth_chtab__key;
+static pthread_once_t bth_chtab__once = PTHREAD_ONCE_INIT;
+static struct bth_centry bth_chtab__tomb;
+
+#define BTH_CHTAB__TOMB (&bth_chtab__tomb)
+
+static void bth_chtab__release(void *p)
+{
+    struct bth_cepoch *e = p;
+
+    atomic_store(&e->epoch, 0);
+    atomic_store(&e->used, false);
+}
+
+static void bth_chtab__keyinit(void)
+{
+    pthread_key_create(&bth_chtab__key, bth_chtab__release);
+}
+
+static void bth_chtab__register(void)
+{
+    pthread_once(&bth_chtab__once, bth_chtab__keyinit);
+
+    for (size_t i = 0; i < BTH_CHTAB_THREADS; i++)
+    {
+        bool f = false;
+
+        if (atomic_compare_exchange_strong(&bth_chtab__epochs[i].used, &f,
+            true))
+        {
+            bth_chtab__self = bth_chtab__epochs + i;
+            pthread_setspecific(bth_chtab__key, bth_chtab__self);
+            return;
+        }
+    }
+
+    BTH_HTAB_ERRX(1, "More than %d threads use concurrent tables",
+        BTH_CHTAB_THREADS);
+}
+
+void bth_chtab__enter(void)
+{
+    if (!bth_chtab__self)
+        bth_chtab__register();
+
+    atomic_store(&bth_chtab__self->epoch, atomic_load(&bth_chtab__epoch));
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+void bth_chtab__exit(void)
+{
+    atomic_store_explicit(&bth_chtab__self->epoch, 0, memory_order_release);
+}
+
+// false if a thread has not seen the current epoch yet
+static bool bth_chtab__advance(void)
+{
+    uint64_t e = atomic_load(&bth_chtab__epoch);
+
+    for (size_t i = 0; i < BTH_CHTAB_THREADS; i++)
+    {
+        uint64_t l = atomic_load(&bth_chtab__epochs[i].epoch);
+
+        if (l && l != e)
+            return false;
+    }
+
+    atomic_compare_exchange_strong(&bth_chtab__epoch, &e, e + 1);
+    return true;
+}
+
+void bth_chtab__retire(struct bth_chtab *ct, struct bth_cshard *sh,
+    void *ptr, size_t size)
+{
+    if (sh->nretired == sh->retcap)
+    {
+        size_t n = sh->retcap ? sh->retcap * 2 : BTH_CHTAB_RECLAIM;
+        struct bth_cretired *r = BTH_HTAB__REALLOC(ct->alloc, sh->retired,
+            sh->retcap * sizeof(struct bth_cretired),
+            n * sizeof(struct bth_cretired));
+
+        if (!r)
+            BTH_HTAB_ERRX(1, "Cannot retire %zu objects", n);
+
+        sh->retired = r;
+        sh->retcap = n;
+    }
+
+    struct bth_cretired r = {ptr, size, atomic_load(&bth_chtab__epoch)};
+
+    sh->retired[sh->nretired++] = r;
+
+    if (sh->nretired >= sh->retmark)
+        bth_chtab__reclaim(ct, sh);
+}
+
+// objects pending behind a slow reader are only looked at again once
+// another BTH_CHTAB_RECLAIM of them were retired
+void bth_chtab__reclaim(struct bth_chtab *ct, struct bth_cshard *sh)
+{
+    // two steps when no reader holds the epoch back
+    if (bth_chtab__advance())
+        bth_chtab__advance();
+
+    uint64_t e = atomic_load(&bth_chtab__epoch);
+    size_t n = 0;
+
+    // epochs never decrease along the list
+    while (n < sh->nretired && sh->retired[n].epoch + 2 <= e)
+    {
+        BTH_HTAB__FREE(ct->alloc, sh->retired[n].ptr, sh->retired[n].size);
+        n++;
+    }
+
+    if (n)
+    {
+        BTH_HTAB_MEMMOVE(sh->retired, sh->retired + n,
+            (sh->nretired - n) * sizeof(struct bth_cretired));
+    }
+
+    sh->nretired -= n;
+    sh->retmark = sh->nretired + BTH_CHTAB_RECLAIM;
+}
+
+struct bth_chtab *bth_chtab_new(size_t nshards, size_t cap)
+{
+    return bth_chtab_new_with(nshards, cap, NULL);
+}
+
+struct bth_chtab *bth_chtab_new_with(size_t nshards, size_t cap,
+    const struct bth_allocator *alloc)
+{
+    struct bth_chtab *ct = BTH_HTAB__ALLOC(alloc, sizeof(struct bth_chtab));
+    size_t n = 1;
+
+    while (n < nshards)
+        n *= 2;
+
+    if (!ct)
+        return NULL;
+
+    ct->nshards = n;
+    ct->alloc = alloc;
+    ct->base = BTH_HTAB__ALLOC(alloc,
+        n * sizeof(struct bth_cshard) + BTH_CHTAB_CACHELINE);
+
+    if (!ct->base)
+        BTH_HTAB_ERRX(1, "Cannot allocate %zu shards", n);
+
+    uintptr_t a = (uintptr_t)ct->base + BTH_CHTAB_CACHELINE - 1;
+    ct->shards = (void *)(a & ~(uintptr_t)(BTH_CHTAB_CACHELINE - 1));
+
+    for (size_t i = 0; i < n; i++)
+    {
+        struct bth_cshard *sh = ct->shards + i;
+        struct bth_ctab *t = bth_chtab__tnew(alloc, cap);
+
+        if (!t)
+            BTH_HTAB_ERRX(1, "Cannot allocate shard of %zu slots", cap);
+
+        pthread_mutex_init(&sh->lock, NULL);
+        atomic_init(&sh->tab, t);
+        sh->len = 0;
+        sh->used = 0;
+        sh->retired = NULL;
+        sh->nretired = 0;
+        sh->retcap = 0;
+        sh->retmark = BTH_CHTAB_RECLAIM;
+    }
+
+    return ct;
+}
+
+void bth_chtab_free(struct bth_chtab *ct)
+{
+    for (size_t i = 0; i < ct->nshards; i++)
+    {
+        struct bth_cshard *sh = ct->shards + i;
+        struct bth_ctab *t = atomic_load(&sh->tab);
+
+        for (size_t j = 0; j < t->cap; j++)
+        {
+            struct bth_centry *e = atomic_load(t->slots + j);
+
+            if (e && e != BTH_CHTAB__TOMB)
+            {
+                BTH_HTAB__FREE(ct->alloc, e,
+                    sizeof(struct bth_centry) + e->klen + 1);
+            }
+        }
+
+        for (size_t j = 0; j < sh->nretired; j++)
+        {
+            BTH_HTAB__FREE(ct->alloc, sh->retired[j].ptr,
+                sh->retired[j].size);
+        }
+
+        BTH_HTAB__FREE(ct->alloc, t, sizeof(struct bth_ctab)
+            + t->cap * sizeof(struct bth_centry *));
+        BTH_HTAB__FREE(ct->alloc, sh->retired,
+            sh->retcap * sizeof(struct bth_cretired));
+        pthread_mutex_destroy(&sh->lock);
+    }
+
+    BTH_HTAB__FREE(ct->alloc, ct->base,
+        ct->nshards * sizeof(struct bth_cshard) + BTH_CHTAB_CACHELINE);
+    BTH_HTAB__FREE(ct->alloc, ct, sizeof(struct bth_chtab));
+}
+
+// high bits, the low ones select slots inside the shard
+struct bth_cshard *bth_chtab__shard(struct bth_chtab *ct, uint64_t hash)
+{
+    return ct->shards + ((bth_hflat__mix(hash) >> 32) & (ct->nshards - 1));
+}
+
+struct bth_ctab *bth_chtab__tnew(const struct bth_allocator *a, size_t cap)
+{
+    size_t c = 8;
+
+    while (c < cap)
+        c *= 2;
+
+    struct bth_ctab *t = BTH_HTAB__ALLOC(a, sizeof(struct bth_ctab)
+        + c * sizeof(struct bth_centry *));
+
+    if (!t)
+        return NULL;
+
+    t->cap = c;
+
+    for (size_t i = 0; i < c; i++)
+        atomic_init(t->slots + i, NULL);
+
+    return t;
+}
+
+struct bth_centry *bth_chtab__probe(struct bth_ctab *t, const char *k,
+    size_t len, uint64_t hash, size_t *slot, size_t *tomb)
+{
+    size_t mask = t->cap - 1;
+    size_t i = hash & mask;
+
+    if (tomb)
+        *tomb = SIZE_MAX;
+
+    for (;; i = (i + 1) & mask)
+    {
+        struct bth_centry *e = atomic_load_explicit(t->slots + i,
+            memory_order_acquire);
+
+        if (slot)
+            *slot = i;
+
+        if (!e)
+            return NULL;
+
+        if (e == BTH_CHTAB__TOMB)
+        {
+            if (tomb && *tomb == SIZE_MAX)
+                *tomb = i;
+
+            continue;
+        }
+
+        if (e->hash == hash && e->klen == len
+            && !BTH_HTAB_MEMCMP(e->key, k, len))
+        {
+            return e;
+        }
+    }
+}
+
+struct bth_ctab *bth_chtab__grow(struct bth_chtab *ct, struct bth_cshard *sh)
+{
+    struct bth_ctab *old = atomic_load_explicit(&sh->tab,
+        memory_order_relaxed);
+    size_t cap = old->cap;
+
+    // at most half full once rebuilt
+    while ((sh->len + 1) * 2 > cap)
+        cap *= 2;
+
+    struct bth_ctab *t = bth_chtab__tnew(ct->alloc, cap);
+
+    if (!t)
+        return NULL;
+
+    for (size_t i = 0; i < old->cap; i++)
+    {
+        struct bth_centry *e = atomic_load_explicit(old->slots + i,
+            memory_order_relaxed);
+
+        if (!e || e == BTH_CHTAB__TOMB)
+            continue;
+
+        size_t s;
+
+        bth_chtab__probe(t, e->key, e->klen, e->hash, &s, NULL);
+        atomic_store_explicit(t->slots + s, e, memory_order_relaxed);
+    }
+
+    atomic_store_explicit(&sh->tab, t, memory_order_release);
+    sh->used = sh->len;
+
+    bth_chtab__retire(ct, sh, old, sizeof(struct bth_ctab)
+        + old->cap * sizeof(struct bth_centry *));
+
+    return t;
+}
+
+enum BTH_CHTAB_STATUS bth_chtab_put(struct bth_chtab *ct, const char *k,
+    void *val)
+{
+    return bth_chtab_putn(ct, k, BTH_HTAB_STRLEN(k), val);
+}
+
+enum BTH_CHTAB_STATUS bth_chtab_putn(struct bth_chtab *ct, const char *k,
+    size_t len, void *val)
+{
+    uint64_t hash = BTH_HTAB_HASHN(k, len);
+    struct bth_cshard *sh = bth_chtab__shard(ct, hash);
+    enum BTH_CHTAB_STATUS res = CHT_OK;
+
+    pthread_mutex_lock(&sh->lock);
+
+    struct bth_ctab *t = atomic_load_explicit(&sh->tab, memory_order_relaxed);
+    size_t s;
+    size_t tomb;
+
+    if (bth_chtab__probe(t, k, len, hash, &s, &tomb))
+        goto unlock;
+
+    if (tomb != SIZE_MAX)
+        s = tomb;
+    else if (sh->used + 1 > t->cap - t->cap / 4)
+    {
+        if (!(t = bth_chtab__grow(ct, sh)))
+        {
+            res = CHT_NOMEM;
+            goto unlock;
+        }
+
+        bth_chtab__probe(t, k, len, hash, &s, NULL);
+    }
+
+    struct bth_centry *e = BTH_HTAB__ALLOC(ct->alloc,
+        sizeof(struct bth_centry) + len + 1);
+
+    if (!e)
+    {
+        res = CHT_NOMEM;
+        goto unlock;
+    }
+
+    e->hash = hash;
+    e->klen = len;
+    e->value = val;
+    BTH_HTAB_MEMCPY(e->key, k, len);
+    e->key[len] = 0;
+
+    if (!atomic_load_explicit(t->slots + s, memory_order_relaxed))
+        sh->used++;
+
+    atomic_store_explicit(t->slots + s, e, memory_order_release);
+    sh->len++;
+    res = CHT_ADDED;
+
+unlock:
+    pthread_mutex_unlock(&sh->lock);
+    return res;
+}
+
+enum BTH_CHTAB_STATUS bth_chtab_get(struct bth_chtab *ct, const char *k,
+    void **val)
+{
+    return bth_chtab_getn(ct, k, BTH_HTAB_STRLEN(k), val);
+}
+
+enum BTH_CHTAB_STATUS bth_chtab_getn(struct bth_chtab *ct, const char *k,
+    size_t len, void **val)
+{
+    uint64_t hash = BTH_HTAB_HASHN(k, len);
+    struct bth_cshard *sh = bth_chtab__shard(ct, hash);
+
+    bth_chtab__enter();
+
+    struct bth_ctab *t = atomic_load_explicit(&sh->tab, memory_order_acquire);
+    struct bth_centry *e = bth_chtab__probe(t, k, len, hash, NULL, NULL);
+
+    if (e && val)
+        *val = e->value;
+
+    bth_chtab__exit();
+
+    return e ? CHT_OK : CHT_NOTFOUND;
+}
+
+enum BTH_CHTAB_STATUS bth_chtab_delete(struct bth_chtab *ct, const char *k,
+    void **val)
+{
+    return bth_chtab_deleten(ct, k, BTH_HTAB_STRLEN(k), val);
+}
+
+enum BTH_CHTAB_STATUS bth_chtab_deleten(struct bth_chtab *ct, const char *k,
+    size_t len, void **val)
+{
+    uint64_t hash = BTH_HTAB_HASHN(k, len);
+    struct bth_cshard *sh = bth_chtab__shard(ct, hash);
+
+    pthread_mutex_lock(&sh->lock);
+
+    struct bth_ctab *t = atomic_load_explicit(&sh->tab, memory_order_relaxed);
+    size_t s;
+    struct bth_centry *e = bth_chtab__probe(t, k, len, hash, &s, NULL);
+
+    if (e)
+    {
+        if (val)
+            *val = e->value;
+
+        atomic_store_explicit(t->slots + s, BTH_CHTAB__TOMB,
+            memory_order_release);
+        sh->len--;
+        bth_chtab__retire(ct, sh, e, sizeof(struct bth_centry) + len + 1);
+    }
+
+    pthread_mutex_unlock(&sh->lock);
+
+    return e ? CHT_OK : CHT_NOTFOUND;
+}
+
+#undef BTH_CHTAB__TOMB
+
+#endif
+
+#ifdef BTH_HTAB_SNAPSHOT
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BTH_HSNAP__ALIGN(n) (((n) + 7) & ~(uint64_t)7)
+
+int bth_htab_dump(struct bth_htab *ht, const char *path,
+    bth_hsnap_vbytes vbytes)
+{
+    struct bth_hsnap_hdr hdr = {.magic = BTH_HSNAP_MAGIC,
+        .version = BTH_HSNAP_VERSION, .seed = bth_htab_seed};
+    size_t n = 0;
+
+    for (size_t i = 1; i < ht->top; i++)
+        n += ht->data[i] != NULL;
+
+    size_t nb = 1;
+
+    while (nb < n)
+        nb *= 2;
+
+    uint64_t *buckets = BTH_HTAB_CALLOC(nb + 1, sizeof(uint64_t));
+    struct bth_hsnap_entry *entries = BTH_HTAB_ALLOC(n
+        * sizeof(struct bth_hsnap_entry) + 1);
+    struct bth_hdata **src = BTH_HTAB_ALLOC(n * sizeof(void *) + 1);
+    FILE *f = NULL;
+    int res = -1;
+
+    if (!buckets || !entries || !src)
+    {
+        errno = ENOMEM;
+        goto end;
+    }
+
+    hdr.nbuckets = nb;
+    hdr.nentries = n;
+    hdr.buckets = BTH_HSNAP__ALIGN(sizeof(struct bth_hsnap_hdr));
+    hdr.entries = hdr.buckets + (nb + 1) * sizeof(uint64_t);
+    hdr.blob = hdr.entries + n * sizeof(struct bth_hsnap_entry);
+
+    // counting sort of the entries by bucket
+    for (size_t i = 1; i < ht->top; i++)
+    {
+        struct bth_hdata *hd = ht->data[i];
+
+        if (hd)
+            buckets[(wyhash(hd->key, hd->klen, hdr.seed) & (nb - 1)) + 1]++;
+    }
+
+    for (size_t i = 0; i < nb; i++)
+        buckets[i + 1] += buckets[i];
+
+    for (size_t i = 1; i < ht->top; i++)
+    {
+        struct bth_hdata *hd = ht->data[i];
+
+        if (!hd)
+            continue;
+
+        uint64_t hash = wyhash(hd->key, hd->klen, hdr.seed);
+        size_t b = hash & (nb - 1);
+        size_t e = buckets[b]++;
+
+        src[e] = hd;
+        entries[e].hash = hash;
+    }
+
+    // buckets[b] is now the start of b + 1
+    for (size_t i = nb; i > 0; i--)
+        buckets[i] = buckets[i - 1];
+
+    buckets[0] = 0;
+
+    if (!(f = fopen(path, "wb")))
+        goto end;
+
+    errno = 0;
+
+    // the blob goes first, each value is written as soon as it is fetched,
+    // then header and tables are written in front of it
+    static const char zero[8];
+    uint64_t off = hdr.blob;
+    bool ok = !fseek(f, off, SEEK_SET);
+
+    for (size_t i = 0; ok && i < n; i++)
+    {
+        size_t vlen = 0;
+        const void *val = vbytes ? vbytes(src[i]->value, &vlen) : NULL;
+
+        entries[i].koff = off;
+        entries[i].klen = src[i]->klen;
+        off = BTH_HSNAP__ALIGN(off + src[i]->klen + 1);
+        entries[i].voff = off;
+        entries[i].vlen = val ? vlen : 0;
+        off = BTH_HSNAP__ALIGN(off + entries[i].vlen);
+
+        size_t kpad = entries[i].voff - entries[i].koff - entries[i].klen;
+        size_t vpad = off - entries[i].voff - entries[i].vlen;
+
+        ok = fwrite(src[i]->key, 1, entries[i].klen, f) == entries[i].klen
+            && fwrite(zero, 1, kpad, f) == kpad
+            && (!entries[i].vlen
+                || fwrite(val, 1, entries[i].vlen, f) == entries[i].vlen)
+            && fwrite(zero, 1, vpad, f) == vpad;
+    }
+
+    hdr.size = off;
+
+    size_t pad = hdr.buckets - sizeof(hdr);
+
+    ok = ok && !fseek(f, 0, SEEK_SET)
+        && fwrite(&hdr, sizeof(hdr), 1, f) == 1
+        && fwrite(zero, 1, pad, f) == pad
+        && fwrite(buckets, sizeof(uint64_t), nb + 1, f) == nb + 1
+        && fwrite(entries, sizeof(struct bth_hsnap_entry), n, f) == n;
+
+    if (fclose(f) || !ok)
+    {
+        if (!errno)
+            errno = EIO;
+
+        goto end;
+    }
+
+    res = 0;
+
+end:
+    BTH_HTAB_FREE(buckets);
+    BTH_HTAB_FREE(entries);
+    BTH_HTAB_FREE(src);
+
+    return res;
+}
+
+int bth_hsnap_init(struct bth_hsnap *sn, const void *mem, size_t size)
+{
+    const struct bth_hsnap_hdr *hdr = mem;
+    struct bth_hsnap tmp = {.base = mem, .size = size, .hdr = hdr};
+
+    *sn = tmp;
+
+    if (size < sizeof(*hdr) || BTH_HTAB_MEMCMP(hdr->magic, BTH_HSNAP_MAGIC, 8)
+        || hdr->version != BTH_HSNAP_VERSION || hdr->size > size
+        || !hdr->nbuckets || hdr->nbuckets & (hdr->nbuckets - 1)
+        || hdr->buckets % 8 || hdr->entries % 8
+        || hdr->buckets > hdr->entries || hdr->entries > hdr->blob
+        || hdr->blob > hdr->size
+        || (hdr->entries - hdr->buckets) / 8 != hdr->nbuckets + 1
+        || (hdr->blob - hdr->entries) / sizeof(struct bth_hsnap_entry)
+            != hdr->nentries)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    sn->buckets = (const uint64_t *)(sn->base + hdr->buckets);
+    sn->entries = (const struct bth_hsnap_entry *)(sn->base + hdr->entries);
+
+    // buckets slice entries in order, keys and values lie in the blob
+    bool ok = !sn->buckets[0] && sn->buckets[hdr->nbuckets] == hdr->nentries;
+
+    for (uint64_t i = 0; ok && i < hdr->nbuckets; i++)
+        ok = sn->buckets[i] <= sn->buckets[i + 1];
+
+    for (uint64_t i = 0; ok && i < hdr->nentries; i++)
+    {
+        const struct bth_hsnap_entry *e = sn->entries + i;
+
+        ok = e->koff >= hdr->blob && e->koff < hdr->size
+            && e->klen < hdr->size - e->koff
+            && e->voff >= hdr->blob && e->voff <= hdr->size
+            && e->vlen <= hdr->size - e->voff;
+    }
+
+    if (!ok)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+int bth_hsnap_open(struct bth_hsnap *sn, const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0)
+        return -1;
+
+    if (fstat(fd, &st))
+    {
+        close(fd);
+        return -1;
+    }
+
+    void *mem = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (mem == MAP_FAILED)
+        return -1;
+
+    if (bth_hsnap_init(sn, mem, st.st_size))
+    {
+        munmap(mem, st.st_size);
+        return -1;
+    }
+
+    sn->mapped = true;
+    return 0;
+}
+
+void bth_hsnap_close(struct bth_hsnap *sn)
+{
+    if (sn->mapped)
+        munmap((void *)sn->base, sn->size);
+
+    sn->base = NULL;
+    sn->mapped = false;
+}
+
+const void *bth_hsnap_get(const struct bth_hsnap *sn, const char *key,
+    size_t *vlen)
+{
+    return bth_hsnap_getn(sn, key, BTH_HTAB_STRLEN(key), vlen);
+}
+
+const void *bth_hsnap_getn(const struct bth_hsnap *sn, const char *key,
+    size_t len, size_t *vlen)
+{
+    uint64_t hash = wyhash(key, len, sn->hdr->seed);
+    size_t b = hash & (sn->hdr->nbuckets - 1);
+
+    for (uint64_t i = sn->buckets[b]; i < sn->buckets[b + 1]; i++)
+    {
+        const struct bth_hsnap_entry *e = sn->entries + i;
+
+        if (e->hash != hash || e->klen != len
+            || BTH_HTAB_MEMCMP(sn->base + e->koff, key, len))
+        {
+            continue;
+        }
+
+        if (vlen)
+            *vlen = e->vlen;
+
+        return sn->base + e->voff;
+    }
+
+    return NULL;
+}
+
+#undef BTH_HSNAP__ALIGN
+
+#endif
+
 #endif
 
 #endif
@@ -23,16 +23,29 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "bth_alloc.h"
+
 #ifndef BTH_IO_ALLOC
 #define BTH_IO_ALLOC(t) malloc(t)
 #endif
 
+#define BTH_IO__ALLOC(a, n) ((a) ? (a)->alloc((a)->ctx, n) : BTH_IO_ALLOC(n))
+
 size_t readfn(char **buf, size_t n, const char *path);
+// *buf is allocated through alloc
+size_t readfn_with(char **buf, size_t n, const char *path,
+    const struct bth_allocator *alloc);
 
 #endif
 
 #ifdef BTH_IO_IMPLEMENTATION
 size_t readfn(char **buf, size_t n, const char *path)
+{
+    return readfn_with(buf, n, path, NULL);
+}
+
+size_t readfn_with(char **buf, size_t n, const char *path,
+    const struct bth_allocator *alloc)
 {
     FILE *f = fopen(path, "r");
 
@@ -47,7 +60,7 @@ size_t readfn(char **buf, size_t n, const char *path)
         fseek(f, 0, SEEK_SET);
     }
 
-    char *d = (char *)BTH_IO_ALLOC(len + 1);
+    char *d = (char *)BTH_IO__ALLOC(alloc, len + 1);
     size_t count = fread(d, 1, len, f);
     fclose(f);
     
@@ -0,0 +1,209 @@
+// MIT No Attribution
+// 
+// Copyright (c) 2025 bobthehuge
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to 
+// deal in the Software without restriction, including without limitation the 
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or 
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef BTH_SEGARRAY_H
+#define BTH_SEGARRAY_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "bth_alloc.h"
+
+// array made of segments doubling in size, that are never moved once
+// allocated: item pointers stay valid until the array is freed and growing
+// never copies items
+//
+// with B = 1 << BTH_SEGARRAY_SHIFT items in segs[0]
+//
+// segs = {
+//     [0] = { 0 .. B - 1 }
+//     [1] = { B .. 3B - 1 }
+//     [2] = { 3B .. 7B - 1 }
+//     .
+//     .
+//     .
+// }
+//
+// index i is in segment k = log2(i + B) - BTH_SEGARRAY_SHIFT
+
+#ifndef BTH_SEGARRAY_ALLOC
+#define BTH_SEGARRAY_ALLOC(n) malloc(n)
+#define BTH_SEGARRAY_FREE(p) free(p)
+#endif
+
+#ifndef BTH_SEGARRAY_ERRX
+#include <err.h>
+#define BTH_SEGARRAY_ERRX(c, msg, ...) errx(c, msg, __VA_ARGS__)
+#endif
+
+#ifndef BTH_SEGARRAY_MEMCPY
+#include <string.h>
+#define BTH_SEGARRAY_MEMCPY(dst, src, n) memcpy(dst, src, n)
+#endif
+
+// log2 of the item count of the first segment
+#ifndef BTH_SEGARRAY_SHIFT
+#define BTH_SEGARRAY_SHIFT 6
+#endif
+
+// enough segments to address all of size_t
+#define BTH_SEGARRAY_SEGS (64 - BTH_SEGARRAY_SHIFT)
+
+#define BTH_SEGARRAY__ALLOC(a, n) \
+    ((a) ? (a)->alloc((a)->ctx, n) : BTH_SEGARRAY_ALLOC(n))
+#define BTH_SEGARRAY__FREE(a, p, n) \
+    ((a) ? (a)->free((a)->ctx, p, n) : BTH_SEGARRAY_FREE(p))
+
+struct bth_segarray
+{
+    // item count
+    size_t len;
+    // item size
+    size_t isize;
+    // allocated segments, segs[nsegs] on are NULL
+    size_t nsegs;
+    void *segs[BTH_SEGARRAY_SEGS];
+    const struct bth_allocator *alloc; // BTH_SEGARRAY_ALLOC & co if NULL
+};
+
+void bth_segarray_init(struct bth_segarray *sa, size_t isize);
+void bth_segarray_init_with(struct bth_segarray *sa, size_t isize,
+    const struct bth_allocator *alloc);
+void bth_segarray_free(struct bth_segarray *sa);
+// make room for at least n items
+void bth_segarray_reserve(struct bth_segarray *sa, size_t n);
+// pointer to the item at index, valid until the array is freed
+void *bth_segarray_at(struct bth_segarray *sa, size_t index);
+void bth_segarray_get(struct bth_segarray *sa, size_t index, void *e);
+void bth_segarray_set(struct bth_segarray *sa, size_t index, void *e);
+// return a pointer to the appended item
+void *bth_segarray_append(struct bth_segarray *sa, void *e);
+// segments are kept for the next appends
+void bth_segarray_pop(struct bth_segarray *sa, void *e);
+
+// item count of segment k
+#define BTH_SEGARRAY__SEGLEN(k) ((size_t)1 << (BTH_SEGARRAY_SHIFT + (k)))
+
+void *bth_segarray__item(struct bth_segarray *sa, size_t index);
+
+#endif
+
+#ifdef BTH_SEGARRAY_IMPLEMENTATION
+
+void bth_segarray_init(struct bth_segarray *sa, size_t isize)
+{
+    bth_segarray_init_with(sa, isize, NULL);
+}
+
+void bth_segarray_init_with(struct bth_segarray *sa, size_t isize,
+    const struct bth_allocator *alloc)
+{
+    sa->len = 0;
+    sa->isize = isize;
+    sa->nsegs = 0;
+    sa->alloc = alloc;
+
+    for (size_t k = 0; k < BTH_SEGARRAY_SEGS; k++)
+        sa->segs[k] = NULL;
+}
+
+void bth_segarray_free(struct bth_segarray *sa)
+{
+    for (size_t k = 0; k < sa->nsegs; k++)
+    {
+        BTH_SEGARRAY__FREE(sa->alloc, sa->segs[k],
+            BTH_SEGARRAY__SEGLEN(k) * sa->isize);
+        sa->segs[k] = NULL;
+    }
+
+    sa->nsegs = 0;
+    sa->len = 0;
+}
+
+void bth_segarray_reserve(struct bth_segarray *sa, size_t n)
+{
+    // segments 0 to k - 1 hold B * (2^k - 1) items
+    while (n > (BTH_SEGARRAY__SEGLEN(sa->nsegs) - BTH_SEGARRAY__SEGLEN(0)))
+    {
+        size_t k = sa->nsegs;
+        void *seg = BTH_SEGARRAY__ALLOC(sa->alloc,
+            BTH_SEGARRAY__SEGLEN(k) * sa->isize);
+
+        if (!seg)
+        {
+            BTH_SEGARRAY_ERRX(1,
+                "Cannot allocate segment of %zu items for segarray",
+                BTH_SEGARRAY__SEGLEN(k));
+        }
+
+        sa->segs[k] = seg;
+        sa->nsegs++;
+    }
+}
+
+void *bth_segarray__item(struct bth_segarray *sa, size_t index)
+{
+    size_t i = index + BTH_SEGARRAY__SEGLEN(0);
+    size_t msb = 63 - __builtin_clzll(i);
+    size_t k = msb - BTH_SEGARRAY_SHIFT;
+    size_t off = i - ((size_t)1 << msb);
+
+    return (char *)sa->segs[k] + off * sa->isize;
+}
+
+void *bth_segarray_at(struct bth_segarray *sa, size_t index)
+{
+    if (index >= sa->len)
+        BTH_SEGARRAY_ERRX(1, "%s", "Index out of bound of segarray");
+
+    return bth_segarray__item(sa, index);
+}
+
+void bth_segarray_get(struct bth_segarray *sa, size_t index, void *e)
+{
+    BTH_SEGARRAY_MEMCPY(e, bth_segarray_at(sa, index), sa->isize);
+}
+
+void bth_segarray_set(struct bth_segarray *sa, size_t index, void *e)
+{
+    BTH_SEGARRAY_MEMCPY(bth_segarray_at(sa, index), e, sa->isize);
+}
+
+void *bth_segarray_append(struct bth_segarray *sa, void *e)
+{
+    bth_segarray_reserve(sa, sa->len + 1);
+
+    void *item = bth_segarray__item(sa, sa->len++);
+    BTH_SEGARRAY_MEMCPY(item, e, sa->isize);
+
+    return item;
+}
+
+void bth_segarray_pop(struct bth_segarray *sa, void *e)
+{
+    if (!sa->len)
+        BTH_SEGARRAY_ERRX(1, "%s", "Invalid pop on empty segarray");
+
+    if (e)
+        bth_segarray_get(sa, sa->len - 1, e);
+
+    sa->len--;
+}
+
+#endif